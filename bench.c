@@ -0,0 +1,415 @@
+// micro benchmarks of the sim hot paths, ./nob -bench builds and runs them.
+// Every run starts from the same seeded game, drawing is stubbed so
+// draw_things runs without a GPU
+#include <stddef.h>
+#include "raylib.h"
+
+// what would reach the GPU is folded into a sink so it isn't optimized out
+static volatile float draw_sink = 0;
+
+void bench_draw_texture(Texture2D texture, Rectangle source, Rectangle dest, Vector2 origin, float rotation, Color tint)
+{
+    draw_sink += texture.id + source.width + dest.x + dest.y + origin.x + rotation + tint.r;
+}
+
+void bench_shader_mode(Shader shader)
+{
+    draw_sink += shader.id;
+}
+
+void bench_end_shader_mode(void)
+{
+    draw_sink += 1;
+}
+
+void bench_shader_texture(Shader shader, int loc, Texture2D texture)
+{
+    draw_sink += shader.id + loc + texture.id;
+}
+
+#define DrawTexturePro bench_draw_texture
+#define BeginShaderMode bench_shader_mode
+#define EndShaderMode bench_end_shader_mode
+#define SetShaderValueTexture bench_shader_texture
+#define NO_MAIN
+#include "main.c"
+
+#define BENCH_MAX_PARAMS                            16
+#define BENCH_MAX_RESULTS                           1024
+#define BENCH_MAX_SAMPLES                           1000
+#define BENCH_SAMPLE_NS                             (2 * 1000 * 1000) // a sample runs at least this long
+#define BENCH_SEED                                  1857
+#define BENCH_PAD_KIND                              (MAX_KINDS - 1)   // owner of the padding animations, never spawned
+#define BENCH_NAME_CAPACITY                         32
+#define BENCH_LOOKUP_CAPACITY                       8
+
+// ./nob -bench -scan leaves the kind tables out, only then do lookups walk the -anims padding
+#ifdef KIND_TABLES
+#define BENCH_LOOKUP                                "tables"
+#else
+#define BENCH_LOOKUP                                "scan"
+#endif
+
+typedef enum
+{
+    MIX_IDLE,
+    MIX_WALK,
+    MIX_FIGHT,
+    MIX_NUM
+} StateMix;
+
+const char* MIX_NAMES[MIX_NUM] = {
+    [MIX_IDLE] = "idle",
+    [MIX_WALK] = "walk",
+    [MIX_FIGHT] = "fight",
+};
+
+typedef struct
+{
+    size_t things;     // fighters, the player included
+    size_t animations; // rows in game->animations, padded with a kind nothing uses
+    StateMix mix;
+} BenchParams;
+
+// one pass over the game, returns the operations it did
+typedef size_t (*BenchPass)(Game* game);
+
+typedef struct
+{
+    const char* name;
+    BenchPass pass;
+} Benchmark;
+
+typedef struct
+{
+    char name[BENCH_NAME_CAPACITY];
+    char lookup[BENCH_LOOKUP_CAPACITY]; // how get_animation_idx found the rows
+    BenchParams params;
+    double mean_ns; // per operation
+    double stddev_ns;
+    double min_ns;
+} BenchResult;
+
+static thing_idx fighters[MAX_THINGS];
+static size_t fighter_num = 0;
+static volatile size_t bench_sink = 0;
+
+size_t pass_get_animation_idx(Game* game)
+{
+    size_t sink = 0;
+    for (size_t n = 0; n < fighter_num; n++) sink += get_animation_idx(game, fighters[n]);
+    bench_sink += sink;
+    return fighter_num;
+}
+
+size_t pass_is_in_reach(Game* game)
+{
+    size_t sink = 0;
+    for (size_t a = 0; a < fighter_num; a++)
+    {
+        for (size_t b = 0; b < fighter_num; b++) sink += is_in_reach(game, fighters[a], fighters[b]);
+    }
+    bench_sink += sink;
+    return fighter_num*fighter_num;
+}
+
+size_t pass_calc_attributes(Game* game)
+{
+    calc_attributes(game);
+    return 1;
+}
+
+size_t pass_process_game(Game* game)
+{
+    process_game(game);
+    return 1;
+}
+
+size_t pass_increment_game(Game* game)
+{
+    increment_game(game);
+    return 1;
+}
+
+size_t pass_npc_ai(Game* game)
+{
+    npc_ai(game);
+    return 1;
+}
+
+size_t pass_draw_things(Game* game)
+{
+    draw_things(game);
+    return 1;
+}
+
+Benchmark BENCHMARKS[] = {
+    {"get_animation_idx", pass_get_animation_idx},
+    {"is_in_reach", pass_is_in_reach},
+    {"calc_attributes", pass_calc_attributes},
+    {"process_game", pass_process_game},
+    {"increment_game", pass_increment_game},
+    {"npc_ai", pass_npc_ai},
+    {"draw_things", pass_draw_things},
+};
+
+bool bench_setup(Game* game, BenchParams params)
+{
+    srand(BENCH_SEED);
+    init_game(game);
+    ai_configure(game, AI_THINK_INTERVAL_FRAMES, 0);
+    resources_configure(game, 0);
+    ThingKind kinds[] = {KNIGHT, ORC, YAMABUSHI};
+    // the player and the orc of init_game are the first two
+    for (size_t n = 2; n < params.things; n++)
+    {
+        if (game->thing_num + 1 >= MAX_THINGS) return false;
+        // every recolor of a kind gets drawn
+        ThingKind kind = kinds[n % 3];
+        init_enemy(game, kind, (int)((n/3) % kind_palette_num(game, kind)));
+    }
+    fighter_num = 0;
+    for (thing_idx i = 1; i <= game->thing_num; i++)
+    {
+        if ((game->things[i].traits & CAN_HIT) == CAN_HIT) fighters[fighter_num++] = i;
+    }
+    // spread over the stage so reach and crowd checks see near and far pairs
+    for (size_t n = 1; n < fighter_num; n++) game->things[fighters[n]].position.x = rand() % RENDER_WIDTH;
+    while (game->animation_num < params.animations && game->animation_num < MAX_ANIMATIONS)
+    {
+        Animation* anim = &game->animations[game->animation_num++];
+        *anim = game->animations[1];
+        anim->kind = BENCH_PAD_KIND;
+    }
+    State fight[] = {IDLE, MOVE, INPUT, HIT, DEFEND, TAKE_DAMAGE};
+    for (size_t n = 0; n < fighter_num; n++)
+    {
+        Thing* thing = &game->things[fighters[n]];
+        State state = IDLE;
+        if (params.mix == MIX_WALK) state = MOVE;
+        if (params.mix == MIX_FIGHT) state = fight[n % (sizeof(fight)/sizeof(fight[0]))];
+        if (state == MOVE) thing->velocity.x = (n % 2) ? 1 : -1;
+        if (state == HIT)
+        {
+            thing->damage = 2;
+            memcpy(thing->damage_text, "ab", 2);
+        }
+        if (state == DEFEND) memcpy(thing->defend_text, "abc", 3);
+        state_transition(game, fighters[n], state);
+    }
+    return true;
+}
+
+// the game a sample starts from, so passes that advance it are repeatable
+static Game snapshot;
+static Game game;
+
+BenchResult bench_run(const Benchmark* bench, BenchParams params, size_t samples)
+{
+    // enough passes per sample to rise above the timer resolution
+    size_t passes = 1;
+    for (;;)
+    {
+        memcpy(&game, &snapshot, sizeof(game));
+        uint64_t start_ns = now_ns();
+        for (size_t p = 0; p < passes; p++) bench->pass(&game);
+        if (now_ns() - start_ns >= BENCH_SAMPLE_NS || passes >= (1u << 20)) break;
+        passes *= 2;
+    }
+    static double per_op[BENCH_MAX_SAMPLES];
+    for (size_t s = 0; s < samples; s++)
+    {
+        memcpy(&game, &snapshot, sizeof(game));
+        size_t ops = 0;
+        uint64_t start_ns = now_ns();
+        for (size_t p = 0; p < passes; p++) ops += bench->pass(&game);
+        per_op[s] = (double)(now_ns() - start_ns)/MAX(ops, (size_t)1);
+    }
+    BenchResult result = {.params = params, .min_ns = per_op[0]};
+    snprintf(result.name, sizeof(result.name), "%s", bench->name);
+    snprintf(result.lookup, sizeof(result.lookup), "%s", BENCH_LOOKUP);
+    for (size_t s = 0; s < samples; s++)
+    {
+        result.mean_ns += per_op[s]/samples;
+        result.min_ns = MIN(result.min_ns, per_op[s]);
+    }
+    for (size_t s = 0; s < samples; s++) result.stddev_ns += (per_op[s] - result.mean_ns)*(per_op[s] - result.mean_ns);
+    result.stddev_ns = sqrt(result.stddev_ns/MAX(samples - 1, (size_t)1));
+    return result;
+}
+
+bool bench_same(const BenchResult* a, const BenchResult* b)
+{
+    return strcmp(a->name, b->name) == 0 &&
+           strcmp(a->lookup, b->lookup) == 0 &&
+           a->params.things == b->params.things &&
+           a->params.animations == b->params.animations &&
+           a->params.mix == b->params.mix;
+}
+
+bool bench_save(const char* path, const BenchResult* results, size_t num)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "BENCH: can't write %s: %s", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "bench,lookup,things,animations,mix,mean_ns,stddev_ns,min_ns\n");
+    for (size_t i = 0; i < num; i++)
+    {
+        const BenchResult* r = &results[i];
+        fprintf(file, "%s,%s,%zu,%zu,%s,%.3f,%.3f,%.3f\n", r->name, r->lookup, r->params.things, r->params.animations, MIX_NAMES[r->params.mix], r->mean_ns, r->stddev_ns, r->min_ns);
+    }
+    fclose(file);
+    return true;
+}
+
+size_t bench_load(const char* path, BenchResult* results, size_t capacity)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "BENCH: can't read %s: %s", path, strerror(errno));
+        return 0;
+    }
+    char line[256];
+    size_t num = 0;
+    while (num < capacity && fgets(line, sizeof(line), file) != NULL)
+    {
+        BenchResult r = {0};
+        char mix[16] = {0};
+        if (sscanf(line, "%31[^,],%7[^,],%zu,%zu,%15[^,],%lf,%lf,%lf", r.name, r.lookup, &r.params.things, &r.params.animations, mix, &r.mean_ns, &r.stddev_ns, &r.min_ns) != 8) continue;
+        for (StateMix m = 0; m < MIX_NUM; m++) if (strcmp(mix, MIX_NAMES[m]) == 0) r.params.mix = m;
+        results[num++] = r;
+    }
+    fclose(file);
+    return num;
+}
+
+void bench_print(const BenchResult* r, const BenchResult* baseline, size_t baseline_num)
+{
+    printf("%-18s %6zu %6zu %-6s %12.1f %7.1f%% %12.1f", r->name, r->params.things, r->params.animations, MIX_NAMES[r->params.mix],
+           r->mean_ns, 100.0*r->stddev_ns/r->mean_ns, r->min_ns);
+    for (size_t i = 0; i < baseline_num; i++)
+    {
+        const BenchResult* b = &baseline[i];
+        if (!bench_same(r, b)) continue;
+        double change = 100.0*(r->mean_ns - b->mean_ns)/b->mean_ns;
+        // a difference inside the spread of both runs is noise
+        const char* verdict = "";
+        if (fabs(r->mean_ns - b->mean_ns) > 2.0*(r->stddev_ns + b->stddev_ns)) verdict = change > 0 ? " slower" : " faster";
+        printf(" %+8.1f%%%s", change, verdict);
+    }
+    printf("\n");
+}
+
+size_t parse_sizes(const char* list, size_t* values, size_t capacity)
+{
+    size_t num = 0;
+    const char* cursor = list;
+    while (*cursor != '\0' && num < capacity)
+    {
+        char* end = NULL;
+        values[num++] = strtoul(cursor, &end, 10);
+        if (end == cursor) return 0;
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return num;
+}
+
+size_t parse_mixes(const char* list, StateMix* mixes)
+{
+    size_t num = 0;
+    for (StateMix m = 0; m < MIX_NUM; m++)
+    {
+        const char* found = strstr(list, MIX_NAMES[m]);
+        if (found != NULL) mixes[num++] = m;
+    }
+    return num;
+}
+
+static void usage(FILE* stream)
+{
+    fprintf(stream, "Usage: %s [<FLAGS>]\n", flag_program_name());
+    fprintf(stream, "FLAGS:\n");
+    flag_print_options(stream);
+}
+
+int main(int argc, char** argv)
+{
+    bool help = false;
+    char* things_list = "8,64,512";
+    char* animations_list = "0,1024";
+    char* mix_list = "idle,walk,fight";
+    char* filter = NULL;
+    char* save_path = NULL;
+    char* compare_path = NULL;
+    size_t samples = 20;
+    flag_bool_var(&help, "help", false, "Print this help message.");
+    flag_str_var(&things_list, "things", things_list, "Comma separated fighter counts.");
+    flag_str_var(&animations_list, "anims", animations_list, "Comma separated animation counts, padded with rows of an unused kind, only lookups of ./nob -bench -scan walk them.");
+    flag_str_var(&mix_list, "mix", mix_list, "State mixes of the fighters: idle, walk, fight.");
+    flag_str_var(&filter, "filter", NULL, "Only run benchmarks whose name contains this.");
+    flag_size_var(&samples, "samples", samples, "Samples per benchmark, the variance is over them.");
+    flag_str_var(&save_path, "save", NULL, "Save the results as a baseline csv.");
+    flag_str_var(&compare_path, "compare", NULL, "Compare against a baseline csv saved with -save.");
+    if (!flag_parse(argc, argv))
+    {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+    if (help)
+    {
+        usage(stdout);
+        return 0;
+    }
+    size_t thing_counts[BENCH_MAX_PARAMS];
+    size_t animation_counts[BENCH_MAX_PARAMS];
+    StateMix mixes[MIX_NUM];
+    size_t thing_count_num = parse_sizes(things_list, thing_counts, BENCH_MAX_PARAMS);
+    size_t animation_count_num = parse_sizes(animations_list, animation_counts, BENCH_MAX_PARAMS);
+    size_t mix_num = parse_mixes(mix_list, mixes);
+    if (thing_count_num == 0 || animation_count_num == 0 || mix_num == 0 || samples < 2 || samples > BENCH_MAX_SAMPLES)
+    {
+        usage(stderr);
+        return 1;
+    }
+    static BenchResult baseline[BENCH_MAX_RESULTS];
+    size_t baseline_num = 0;
+    if (compare_path != NULL && (baseline_num = bench_load(compare_path, baseline, BENCH_MAX_RESULTS)) == 0) return 1;
+
+    SetTraceLogLevel(LOG_WARNING);
+    headless = true;
+    static BenchResult results[BENCH_MAX_RESULTS];
+    size_t result_num = 0;
+    printf("animation lookups: %s\n", BENCH_LOOKUP);
+    printf("%-18s %6s %6s %-6s %12s %8s %12s%s\n", "bench", "things", "anims", "mix", "ns/op", "stddev", "min ns/op", baseline_num ? "  vs baseline" : "");
+    for (size_t t = 0; t < thing_count_num; t++)
+    {
+        for (size_t a = 0; a < animation_count_num; a++)
+        {
+            for (size_t m = 0; m < mix_num; m++)
+            {
+                BenchParams params = {.things = MAX(thing_counts[t], (size_t)2), .animations = animation_counts[a], .mix = mixes[m]};
+                if (!bench_setup(&snapshot, params))
+                {
+                    TraceLog(LOG_ERROR, "BENCH: %zu fighters don't fit in %d things", params.things, MAX_THINGS);
+                    return 1;
+                }
+                for (size_t b = 0; b < sizeof(BENCHMARKS)/sizeof(BENCHMARKS[0]); b++)
+                {
+                    if (filter != NULL && strstr(BENCHMARKS[b].name, filter) == NULL) continue;
+                    if (result_num == BENCH_MAX_RESULTS) break;
+                    results[result_num] = bench_run(&BENCHMARKS[b], params, samples);
+                    bench_print(&results[result_num], baseline, baseline_num);
+                    result_num++;
+                }
+                resources_unload_all(&snapshot);
+            }
+        }
+    }
+    if (save_path != NULL && !bench_save(save_path, results, result_num)) return 1;
+    return 0;
+}
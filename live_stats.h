@@ -0,0 +1,90 @@
+// live stats of a running game. main.c publishes them once per frame in a
+// POSIX shared memory segment of its own, stats.c reads every segment on the
+// host without the game ever waiting on a reader
+#ifndef LIVE_STATS_H_
+#define LIVE_STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define LIVE_STATS_MAGIC        0x5453464bu         // "KFST"
+#define LIVE_STATS_VERSION      1
+#define LIVE_STATS_PREFIX       "keyboard_fighter." // segments are /keyboard_fighter.<pid>
+#define LIVE_STATS_PHASES       5                   // TickPhase of main.c
+#define LIVE_STATS_STATES       7                   // State of main.c
+#define LIVE_STATS_READ_RETRIES 1000
+
+// in the order of main.c's enums, which assert the counts
+static const char* const TICK_PHASE_NAMES[LIVE_STATS_PHASES] = {
+    "process_input",
+    "npc_ai",
+    "process_game",
+    "draw_game",
+    "increment_game",
+};
+
+static const char* const STATE_NAMES[LIVE_STATS_STATES] = {
+    "IDLE",
+    "HIT",
+    "MOVE",
+    "INPUT",
+    "DEFEND",
+    "TAKE_DAMAGE",
+    "DEATH",
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    _Atomic uint32_t seq; // odd while the game writes a frame
+    uint64_t frame;
+    uint64_t tick;
+    float frame_p50_ms;   // over the pacer window
+    float frame_p99_ms;
+    float frame_max_ms;
+    uint32_t missed_deadlines;
+    float phase_ms[LIVE_STATS_PHASES]; // of the last frame
+    uint32_t thing_num;
+    uint32_t active_num;
+    uint32_t npc_num;
+    float keystroke_p50_ms; // input to presented
+    float keystroke_p99_ms;
+    float cpm;
+    float accuracy;       // percent of the session's keystrokes
+    uint32_t player_state;
+    uint32_t player_pending; // chars of the defend text left to type
+} LiveStats;
+
+// the writer brackets every update, readers retry while it is inside
+static inline void live_stats_write_begin(LiveStats* stats)
+{
+    uint32_t seq = atomic_load_explicit(&stats->seq, memory_order_relaxed);
+    atomic_store_explicit(&stats->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void live_stats_write_end(LiveStats* stats)
+{
+    uint32_t seq = atomic_load_explicit(&stats->seq, memory_order_relaxed);
+    atomic_store_explicit(&stats->seq, seq + 1, memory_order_release);
+}
+
+// a consistent copy, false if the writer kept it busy for every retry
+static inline bool live_stats_read(const LiveStats* shared, LiveStats* copy)
+{
+    for (int attempt = 0; attempt < LIVE_STATS_READ_RETRIES; attempt++)
+    {
+        uint32_t begin = atomic_load_explicit((_Atomic uint32_t*)&shared->seq, memory_order_acquire);
+        if (begin & 1) continue;
+        memcpy(copy, (const void*)shared, sizeof(*copy));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit((_Atomic uint32_t*)&shared->seq, memory_order_relaxed) == begin) return true;
+    }
+    return false;
+}
+
+#endif // LIVE_STATS_H_
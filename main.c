@@ -1,11 +1,69 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <time.h>
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+#include <sys/stat.h>
 #include "raylib.h"
 #include "raymath.h"
+#include "live_stats.h"
+#define FLAG_IMPLEMENTATION
+#include "flag.h"
+
+// -headless runs the simulation without a window or GL context, uploads
+// only keep what the game measures of them
+bool headless = false;
+
+Texture2D texture_from_image(Image image)
+{
+    static unsigned int headless_id = 0;
+    if (!headless) return LoadTextureFromImage(image);
+    return (Texture2D){.id = ++headless_id, .width = image.width, .height = image.height, .mipmaps = 1, .format = image.format};
+}
+
+void texture_unload(Texture2D texture)
+{
+    if (!headless) UnloadTexture(texture);
+}
+
+void texture_update(Texture2D texture, const void* pixels)
+{
+    if (!headless) UpdateTexture(texture, pixels);
+}
+
+Shader shader_from_memory(const char* vertex, const char* fragment)
+{
+    return headless ? (Shader){0} : LoadShaderFromMemory(vertex, fragment);
+}
+
+void shader_unload(Shader shader)
+{
+    if (!headless) UnloadShader(shader);
+}
+
+int shader_location(Shader shader, const char* name)
+{
+    return headless ? -1 : GetShaderLocation(shader, name);
+}
 //enable debug view of thing position, hitbox, reach
 // #define DEBUG_THINGS
 // #define DEBUG_ATTR
@@ -15,17 +73,52 @@
 #define MAX_SPRITES                                 100
 #define MAX_SPRITES_PER_SPRITE_SHEET                24
 #define MAX_TEXTURES_PER_ANIMATION                  24 * 2
+#define MAX_FRAME_BOXES                             2048
+#define FRAME_MASK_DIM                              32  // hit/hurt masks are FRAME_MASK_DIM x FRAME_MASK_DIM cells over their box
+#define ALPHA_THRESHOLD                             16  // pixels with lower alpha count as transparent
+#define BODY_UNBOUNDED                              (1 << 20)
+#define MAX_SHEETS                                  64
+#define FRAME_CACHE_BITS                            12  // open addressing, keep it well above MAX_FRAME_BOXES
+#define FRAME_CACHE_SIZE                            (1 << FRAME_CACHE_BITS)
+#define SHEET_PATH_CAPACITY                         256
+#define PALETTE_SIZE                                64  // colors per palette, index 0 is transparent
+#define MAX_PALETTES                                64
+#define MAX_PALETTE_VARIANTS                        4   // recolors per sprite set
+#define TEXTURE_BUDGET_KB                           (16 * 1024) // unused kinds are evicted above this
+#define HOT_RELOAD_MAX_WATCHES                      32
+#define HOT_RELOAD_MAX_SHEETS                       32  // sheets and variant sheets of one kind
+#define HOT_RELOAD_DEBOUNCE_NS                      (100 * 1000 * 1000) // editors write a file in several steps
+#define HOT_RELOAD_MAX_PENDING                      8   // decoded kinds waiting for the next frame
+#define MAX_KINDS                                   256 // built in kinds plus the ones the manifest registers
+#define KIND_NAME_CAPACITY                          32
+#define MANIFEST_PATH                               "assets/sprites.manifest"
+#define MANIFEST_BIN_PATH                           "assets/sprites.manifest.bin"
+#define MANIFEST_TEXT_CAPACITY                      (256 * 1024)
+#define MANIFEST_STRINGS_CAPACITY                   (64 * 1024)
+#define MANIFEST_MAGIC                              0x464d464bu // "KFMF"
+#define MANIFEST_VERSION                            1
+#define REPLAY_MAGIC                                0x5052464bu // "KFRP"
+#define REPLAY_VERSION                              1
+#define TELEMETRY_MAGIC                             0x5354464bu // "KFTS"
+#define TELEMETRY_VERSION                           1
 
 #define SCREEN_WIDTH                                1024 * 1
 #define SCREEN_HEIGHT                               1024 * 1
-#define LINE_NUMBER_OFFSET                          (int)(SCREEN_WIDTH*0.1)
+
+// the world is drawn into a RENDER_WIDTH x RENDER_HEIGHT pixel-art target
+// and presented with one nearest-neighbor upscale, so the window size never
+// leaks into textures or world coordinates
+#define RENDER_SCALE                                2
+#define RENDER_WIDTH                                (SCREEN_WIDTH / RENDER_SCALE)
+#define RENDER_HEIGHT                               (SCREEN_HEIGHT / RENDER_SCALE)
+#define LINE_NUMBER_OFFSET                          (int)(RENDER_WIDTH*0.1)
 
 #define GRID_Y                                      15 
 #define GRID_X                                      30 
 
-#define CELL_HEIGHT                                 (int)(SCREEN_HEIGHT/GRID_Y)  
-#define CELL_WIDTH                                  (int)(SCREEN_WIDTH/GRID_X)
-#define WORLD_UNIT                                  (int)(SCREEN_HEIGHT/GRID_Y)  
+#define CELL_HEIGHT                                 (int)(RENDER_HEIGHT/GRID_Y)  
+#define CELL_WIDTH                                  (int)(RENDER_WIDTH/GRID_X)
+#define WORLD_UNIT                                  (int)(RENDER_HEIGHT/GRID_Y)  
 #define GRID_TRANSPARENCY                           20 
 
 #define THING_HEIGHT_DEFAULT		                (int)(CELL_HEIGHT * 2)
@@ -33,6 +126,7 @@
 #define HIT_TEXT_POSITION_Y                         (int)(CELL_HEIGHT * 0.9)
 #define HIT_TEXT_HEIGHT                             (int)(CELL_HEIGHT * 0.1)
 #define HIT_TEXT_CAPACITY                           500
+#define HIT_TEXT_FONT_SIZE                          (24 / RENDER_SCALE)
 
 #define STAGE_COORDINATE                            CELL_HEIGHT * (GRID_Y - 2)
 
@@ -41,6 +135,33 @@
 #define FRAMERATE                                   60
 #define MS_PER_FRAME                                (1000.0f/FRAMERATE)
 
+#define NS_PER_SEC                                  1000000000ull
+#define PACER_SPIN_MARGIN_NS                        (2 * 1000 * 1000) // sleep until this close to the deadline, then spin
+#define PACER_STATS_WINDOW                          (FRAMERATE * 2)
+#define INPUT_QUEUE_CAPACITY                        64
+
+// latency histograms are log-linear: every power of two of microseconds is
+// split into LATENCY_SUB_BUCKETS linear buckets
+#define LATENCY_SUB_BUCKETS_LOG2                    2
+#define LATENCY_SUB_BUCKETS                         (1 << LATENCY_SUB_BUCKETS_LOG2)
+#define LATENCY_MAX_US_LOG2                         24
+#define LATENCY_BUCKET_NUM                          ((LATENCY_MAX_US_LOG2 - LATENCY_SUB_BUCKETS_LOG2 + 2) * LATENCY_SUB_BUCKETS)
+
+#define TELEMETRY_KEYS                              128 // ascii, the hit text is drawn from CHARSET
+#define TELEMETRY_CPM_WINDOW_TICKS                  (FRAMERATE * 10)
+
+#define TRACE_MAX_THREADS                           8
+#define TRACE_BUFFER_EVENTS                         (1 << 16) // per thread, zones closed while it is full are dropped
+#define TRACE_MAX_DEPTH                             32
+#define TRACE_FLUSH_INTERVAL_NS                     (50 * 1000 * 1000)
+#define ALLOC_MAX_ZONES                             64
+#define ALLOC_STEADY_TICKS                          FRAMERATE // tick phases must not allocate after this
+#define ALLOC_EXEMPT_ZONE                           "resource_load" // loads allocate, the zones around them don't count it
+#define EVENT_LOG_MAX_THREADS                       8
+#define EVENT_LOG_RING_RECORDS                      (1 << 14) // per thread, records logged while it is full are dropped
+#define EVENT_LOG_FLUSH_INTERVAL_NS                 (20 * 1000 * 1000)
+#define EVENT_LOG_ARGS                              4
+
 #define HIT_DURATION_MS                             300.0f
 #define HIT_DURATION_FRAMES                         (int)((int)HIT_DURATION_MS / (int)MS_PER_FRAME)
 
@@ -59,28 +180,37 @@
 #define WALK_ANIMATION_DURATION_MS                  500 
 #define WALK_ANIMATION_DURATION_FRAMES              (int)((int)WALK_ANIMATION_DURATION_MS / (int)MS_PER_FRAME)
 #define WALK_SPEED_PERC_PER_MS                      0.02f 
-#define WALK_INCREMENT_PIXEL_PER_FRAME              ((MS_PER_FRAME*WALK_SPEED_PERC_PER_MS) / 100.0f) * SCREEN_WIDTH
+#define WALK_INCREMENT_PIXEL_PER_FRAME              ((MS_PER_FRAME*WALK_SPEED_PERC_PER_MS) / 100.0f) * RENDER_WIDTH
 
 #define FLY_ANIMATION_DURATION_MS                  700 
 #define FLY_ANIMATION_DURATION_FRAMES              (int)((int)FLY_ANIMATION_DURATION_MS / (int)MS_PER_FRAME)
 #define FLY_SPEED_PERC_PER_MS                      0.02f 
-#define FLY_INCREMENT_PIXEL_PER_FRAME              ((MS_PER_FRAME*FLY_SPEED_PERC_PER_MS) / 100.0f) * SCREEN_WIDTH
+#define FLY_INCREMENT_PIXEL_PER_FRAME              ((MS_PER_FRAME*FLY_SPEED_PERC_PER_MS) / 100.0f) * RENDER_WIDTH
 
 #define DEFENDING_STATE_DURATION_MS                     500
 #define DEFENDING_STATE_FRAMES                      (int)((int)INPUT_MODE_DURATION_MS / (int)MS_PER_FRAME)
 #define VELOCITY_DECAY_PER_SECOND                   20.0f
 #define GRAVITY_UNITS_PER_SECOND_SQ                 20.0f
 #define MAX_FALL_SPEED_UNITS_PER_SECOND             25.0f
+#define NPC_STOP_DISTANCE                           (CELL_WIDTH * 2)
+#define AI_THINK_INTERVAL_FRAMES                    6   // frames between expensive decisions of one npc
+#define AI_BUDGET_US                                500 // per frame, 0 disables the budget
+#define TIMER_WHEEL_BITS                            8
+#define TIMER_WHEEL_SLOTS                           (1 << TIMER_WHEEL_BITS) // ticks covered by the fine level
+#define TIMER_WHEEL_COARSE_SLOTS                    64                      // each covers TIMER_WHEEL_SLOTS ticks
+#define NPC_AGGRO_DISTANCE                          RENDER_WIDTH        // npcs farther away than this stand still
+#define NPC_DORMANT_DISTANCE                        NPC_AGGRO_DISTANCE  // idle npcs out of aggro range fall asleep
+#define AI_DORMANT_INTERVAL_FACTOR                  4                   // sleeping npcs think this many times less often
+#define CROWD_SEPARATION_RADIUS                     (CELL_WIDTH * 1.5f)
+#define CROWD_SEPARATION_SPEED                      2.0f  // WORLD_UNIT per second at full overlap
+#define CROWD_SEPARATION_DEADZONE                   0.05f // smaller pushes are dropped so crowds come to rest
+#define CROWD_HASH_BITS                             10
+#define CROWD_HASH_SIZE                             (1 << CROWD_HASH_BITS)
+#define NPC_DEFAULT_CPM                             200.0f
+#define NPC_DEFAULT_CPM_JITTER                      0.3f // standard deviation of a keystroke interval, relative to the mean
+#define NPC_HEALTH                                  10   // chars left untyped when defending
 
 
-
-#define ADD_ANCHORS(sprite_set, IMAGE_KIND, ...) \
-    do { \
-        int _anchors_[] = {__VA_ARGS__}; \
-        assert(sizeof(_anchors_)/sizeof(_anchors_[0]) == (sprite_set).sprites[(IMAGE_KIND)].frame_num); \
-        memcpy((sprite_set).sprites[(IMAGE_KIND)].anchors, _anchors_, sizeof(_anchors_)); \
-    } while (0)
-
 #define MIN(i, j) (((i) < (j)) ? (i) : (j))
 #define MAX(i, j) (((i) > (j)) ? (i) : (j))
 
@@ -167,7 +297,8 @@ typedef struct{
     ThingKind kind;
     Attributes attr;
     State state;
-    size_t state_cnt;
+    size_t state_start;  // tick the state was entered
+    size_t state_expire; // tick the state ends, 0 if it doesn't end on its own
     int damage;
     int health;
     Vector2 position;
@@ -178,10 +309,15 @@ typedef struct{
     size_t default_movement_speed_px;
     float height; // in percent from CELL_HEIGHT
     float width; // in percent from CELL_HEIGHT
-    float accuracy;     //for npc 
+    float accuracy;     //for npc, chance in percent that a keystroke is correct
+    float cpm;          //for npc, typing speed when defending
+    float cpm_jitter;   //for npc
     char damage_text[DEFEND_TEXT_CAPACITY]; // text that thing inputted to successfylly attack
     char defend_text[DEFEND_TEXT_CAPACITY]; // text that thing must input to successfully defend
     char key_pressed;
+    size_t ai_next_think; // tick of the next expensive ai decision
+    bool ai_move;         // last ai decision, applied by the per tick steering
+    int palette;          // recolor of the kind, 0 is the base colors
 } Thing;
 
 typedef enum
@@ -196,6 +332,21 @@ typedef enum
     IMAGE_KIND_NUM
 } ImageKind;   
 
+// animations a sprite set has a duration for
+typedef enum
+{
+    DURATION_IDLE,
+    DURATION_INPUT,
+    DURATION_HIT,
+    DURATION_WALK,
+    DURATION_FLY,
+    DURATION_DEFEND,
+    DURATION_DAMAGE,
+    DURATION_NUM
+} AnimationDuration;
+
+// frame_num, anchors and widths left at 0 are detected from the alpha
+// channel of the sheet, anything set by hand is kept
 typedef struct
 {
     Image image;
@@ -203,16 +354,66 @@ typedef struct
     size_t frame_num; 
     int anchors[MAX_SPRITES_PER_SPRITE_SHEET];
     int widths[MAX_SPRITES_PER_SPRITE_SHEET];
+    Rectangle bounds[MAX_SPRITES_PER_SPRITE_SHEET]; // opaque pixels of each frame
+    int baseline;   // one past the lowest opaque row of the sheet, every frame is cropped down to it
 } Sprite;
 
 typedef struct
 {
     Sprite sprites[IMAGE_KIND_NUM];
     ThingKind kind;
-    size_t figure_width; 
-    size_t figure_height;
+    size_t figure_width;  // default frame width, 0 trims every frame to its opaque columns
+    size_t figure_height; // picks the whole scale closest to THING_HEIGHT_DEFAULT, 0 measures the idle pose
+    // front edge of the body from the frame center, measured on the first
+    // idle frame. Opaque pixels ahead of it are the weapon
+    int body_right;
+    // directories holding recolors of the same sheets. Each becomes a
+    // palette of the set, the frames are stored as palette indices
+    const char* variants[MAX_PALETTE_VARIANTS];
+    int palette; // first palette row of the set, -1 if the frames are rgba
+    size_t durations[DURATION_NUM]; // frames, 0 keeps the default
 } SpriteSet;
 
+// a kind as the manifest describes it. Strings are offsets into the
+// string pool so the compiled manifest is the struct as it is in memory
+typedef struct
+{
+    uint32_t name;
+    uint32_t traits;
+    uint32_t sheets[IMAGE_KIND_NUM];
+    uint32_t variants[MAX_PALETTE_VARIANTS];
+    int32_t frame_num[IMAGE_KIND_NUM];
+    int32_t anchors[IMAGE_KIND_NUM][MAX_SPRITES_PER_SPRITE_SHEET];
+    int32_t widths[IMAGE_KIND_NUM][MAX_SPRITES_PER_SPRITE_SHEET];
+    int32_t figure_width;
+    int32_t figure_height;
+    int32_t durations_ms[DURATION_NUM];
+} ManifestKind;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind_num;
+    uint32_t string_len;
+} ManifestHeader;
+
+typedef struct
+{
+    ManifestKind kinds[MAX_KINDS];
+    size_t kind_num;
+    char strings[MANIFEST_STRINGS_CAPACITY]; // offset 0 is the empty string
+    size_t string_len;
+} Manifest;
+
+typedef struct
+{
+    Rectangle hurtbox; // body, in texture pixels of the frame
+    Rectangle hitbox;  // weapon, in texture pixels of the frame, empty if the frame doesn't strike
+    uint32_t hurt_mask[FRAME_MASK_DIM];
+    uint32_t hit_mask[FRAME_MASK_DIM];
+} FrameBoxes;
+
 typedef struct
 {
     Texture2D textures[MAX_SPRITES];
@@ -220,113 +421,2219 @@ typedef struct
     ThingKind kind;
     size_t sprite_num;
     size_t duration_frames;
+    float scale; // world pixels per texture pixel, textures stay at native sprite size
+    bool flipped; // shares textures with the right looking animation, mirrored at draw time
+    size_t boxes; // first of sprite_num entries in game->frame_boxes, 0 if there are none
+    int strike_frame; // frame whose hitbox reaches furthest, -1 if the animation never strikes
+    int palette; // palette row of the base colors when textures hold palette indices, -1 for rgba
 } Animation;
 
+typedef struct
+{
+    char path[SHEET_PATH_CAPACITY];
+    uint64_t hash; // of the decoded pixels
+    Image image;
+    bool owner; // another path decoded to the same pixels, the image is borrowed from it
+} CachedSheet;
+
+typedef struct
+{
+    uint64_t hash; // 0 marks an empty slot
+    int width;
+    int height;
+    void* pixels; // copy of the frame, a hash match is confirmed against it
+    Texture2D texture;
+    size_t refs; // animation frames using the texture
+} CachedFrame;
+
+// content addressed loading: sheets are decoded once per path and shared
+// between paths with identical pixels, identical frames share one texture
+// across animations and kinds. Decoded sheets only live while loading
+typedef struct
+{
+    CachedSheet sheets[MAX_SHEETS];
+    size_t sheet_num;
+    CachedFrame frames[FRAME_CACHE_SIZE];
+    size_t frame_num;
+    size_t sheet_hits;
+    size_t frame_hits;
+    size_t texture_bytes; // live textures, shared ones counted once
+} AssetCache;
+
+// what a kind needs to be drawn. The definition is kept, the textures are
+// loaded when the first thing of the kind spawns and may be evicted again
+// once no thing of the kind is left
+typedef struct
+{
+    SpriteSet set;
+    Traits traits;
+    bool defined;
+    bool loaded;
+    size_t refs;       // live things of the kind
+    size_t last_drawn; // tick
+    // appended by every load, given back by the unload
+    size_t first_animation;
+    size_t animation_num;
+    size_t first_box;
+    size_t box_num;
+    size_t texture_bytes;
+    size_t loads;
+    bool tabled; // the loaded animations are laid out as the generated tables say
+} KindResources;
+
+typedef struct
+{
+    KindResources kinds[MAX_KINDS];
+    char names[MAX_KINDS][KIND_NAME_CAPACITY];
+    size_t kind_num; // the built in ones come first
+    size_t budget_bytes; // 0 is unlimited
+    bool show;
+} Resources;
+
+// rows of colors for indexed frames, resolved by the palette shader. A
+// recolored variant of a set costs one row
+typedef struct
+{
+    Color colors[MAX_PALETTES][PALETTE_SIZE];
+    size_t num;
+    Texture2D texture;
+    Shader shader;
+    int texture_loc;
+} Palettes;
+
+typedef struct
+{
+    int ch;
+    uint64_t timestamp_ns; // when the poll that delivered the char returned
+} InputEvent;
+
+// movement keys are read as held, not typed
+typedef enum
+{
+    HELD_RIGHT = (1<<0),
+    HELD_LEFT = (1<<1),
+    HELD_UP = (1<<2),
+} HeldKeys;
+
+// everything the player did in a tick, a replay is one per tick
+typedef struct
+{
+    uint8_t ch;
+    uint8_t held;
+} ReplayFrame;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed; // of rand, the hit text and npc typing depend on it
+    uint32_t frame_ms;
+} ReplayHeader;
+
+typedef struct
+{
+    FILE* file;
+    bool recording;
+    bool playing;
+    size_t frames;
+} Replay;
+
+// chars are drained from raylib into this ring as soon as they are polled, so
+// re-polling right before the sim step can't drop keystrokes and the sim can
+// consume one char per tick without losing fast typing bursts
+typedef struct
+{
+    InputEvent events[INPUT_QUEUE_CAPACITY];
+    size_t head;
+    size_t tail;
+} InputQueue;
+
+typedef enum
+{
+    LATENCY_CONSUMED = 0, // keystroke read by INPUT/DEFEND handling
+    LATENCY_STATE,        // keystroke changed the player's state
+    LATENCY_PRESENTED,    // EndDrawing returned for the frame showing it
+    LATENCY_STAGE_NUM,
+} LatencyStage;
+
+typedef struct
+{
+    uint64_t buckets[LATENCY_BUCKET_NUM];
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+} LatencyHistogram;
+
+typedef struct
+{
+    LatencyHistogram stages[LATENCY_STAGE_NUM];
+    uint64_t input_ns; // timestamp of the keystroke in flight this frame, 0 if none
+    bool marked[LATENCY_STAGE_NUM];
+    bool show;
+} LatencyTracker;
+
+typedef enum
+{
+    TELEMETRY_INPUT = 0, // typing the hit text to attack
+    TELEMETRY_DEFEND,    // typing an attacker's damage text back
+    TELEMETRY_MODE_NUM,
+} TelemetryMode;
+
+// keystrokes against one target key, misses are charged to the key that was expected
+typedef struct
+{
+    uint32_t hits[TELEMETRY_MODE_NUM];
+    uint32_t misses[TELEMETRY_MODE_NUM];
+    LatencyHistogram reaction; // from the key becoming the target to typing it, hit or miss
+} KeyTelemetry;
+
+// the player's typing over the session. The sim consumes a char per tick,
+// so times are in ticks and replays reproduce them exactly
+typedef struct
+{
+    KeyTelemetry keys[TELEMETRY_KEYS];
+    size_t window[TELEMETRY_CPM_WINDOW_TICKS]; // ring of the ticks of correct keystrokes
+    size_t window_head;
+    size_t window_num;
+    size_t last_key_tick;
+    float cpm;
+    float peak_cpm;
+    uint64_t good_ticks;   // rolling cpm at or above GOOD_CPM
+    uint64_t typing_ticks; // the window held a keystroke
+} Telemetry;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frame_ms;
+    uint32_t ticks;
+    uint32_t good_cpm;
+    uint32_t good_ticks;
+    uint32_t typing_ticks;
+    float peak_cpm;
+    uint32_t key_num; // TelemetryKey records follow
+} TelemetryHeader;
+
+// followed by bucket_num TelemetryBucket, only buckets that were hit
+typedef struct
+{
+    uint32_t key;
+    uint32_t hits[TELEMETRY_MODE_NUM];
+    uint32_t misses[TELEMETRY_MODE_NUM];
+    uint32_t bucket_num;
+    uint64_t sum_us;
+    uint64_t max_us;
+} TelemetryKey;
+
+typedef struct
+{
+    uint32_t bucket;
+    uint32_t count;
+} TelemetryBucket;
+
+typedef struct
+{
+    const char* name; // static strings only, the drainer formats them later
+    uint64_t begin_ns;
+    uint64_t end_ns;
+} TraceEvent;
+
+struct Drainer;
+
+// records of one thread. The owner appends at head, the drainer thread
+// formats them from tail, neither waits on the other
+typedef struct
+{
+    unsigned char* records; // capacity records of the drainer's record_size
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    _Atomic bool ready;     // tid and name are set
+    int tid;
+    char name[32];
+    bool named;             // drainer only, the thread name was written
+    size_t dropped;
+} SpscRing;
+
+// one ring per recording thread, formatted into a file by a background
+// thread so the recording threads only ever copy a record
+typedef struct Drainer
+{
+    const char* prefix;     // of the TraceLog messages
+    const char* unit;       // what a record is, for the report
+    SpscRing* rings;
+    size_t max_rings;
+    unsigned char* records; // storage of every ring, max_rings*capacity records
+    size_t record_size;
+    size_t capacity;
+    long interval_ns;       // between two drains
+    void (*header)(struct Drainer* drainer); // optional, written before the first record
+    void (*format)(struct Drainer* drainer, SpscRing* ring, const void* record);
+    void (*footer)(struct Drainer* drainer); // optional, written after the last record
+    _Atomic size_t ring_num;
+    _Atomic bool enabled;
+    _Atomic bool quit;
+    FILE* file;
+    const char* path;
+    uint64_t start_ns;
+    size_t written;
+#ifdef __linux__
+    pthread_t thread;
+#endif
+} Drainer;
+
+// the zones a thread is inside of, for the tracer and the allocation tracker
+typedef struct
+{
+    const char* names[TRACE_MAX_DEPTH];
+    uint64_t begin_ns[TRACE_MAX_DEPTH];
+    uint64_t allocs[TRACE_MAX_DEPTH]; // made in the zone or the zones nested in it, short of ALLOC_EXEMPT_ZONE
+    size_t depth;
+} ZoneStack;
+
+// allocations made while a zone was the innermost one, frees are counted
+// where they happen, not where the memory was allocated
+typedef struct
+{
+    _Atomic(const char*) name;
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t frees;
+} AllocZone;
+
+// the parts of a tick that are timed, traced and counted
+typedef enum
+{
+    TICK_PROCESS_INPUT = 0,
+    TICK_NPC_AI,
+    TICK_PROCESS_GAME,
+    TICK_DRAW_GAME,
+    TICK_INCREMENT_GAME,
+    TICK_PHASE_NUM,
+} TickPhase;
+
+typedef enum
+{
+    COUNTER_CYCLES = 0,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_NUM,
+} PerfCounter;
+
+// hardware counters of the game thread, read as one group at the
+// boundaries of every tick phase
+typedef struct
+{
+    bool enabled;
+    int leader;                   // fd of the group
+    int fds[COUNTER_NUM];         // -1 if the cpu doesn't have the counter
+    int slot[COUNTER_NUM];        // position in a group read
+    size_t opened;
+    uint64_t begin[COUNTER_NUM];
+    uint64_t begin_enabled;
+    uint64_t begin_running;
+    uint64_t totals[TICK_PHASE_NUM][COUNTER_NUM]; // scaled up where the group was multiplexed
+    uint64_t ticks[TICK_PHASE_NUM];
+    uint64_t thing_ticks[TICK_PHASE_NUM]; // things that existed, summed over the ticks
+    uint64_t scaled_ticks;                // phases the group only counted part of
+    uint64_t unscheduled_ticks;           // phases the group didn't count at all, left out
+    uint64_t time_enabled;                // of the last group read
+    uint64_t time_running;
+} PerfCounters;
+
+typedef enum
+{
+    LOG_EVENT_ATTRIBUTES = 0, // attr
+    LOG_EVENT_PLAYER_TICK,    // tick, attr, state age, animation duration
+    LOG_EVENT_STATE,          // tick, thing, old state, new state
+    LOG_EVENT_NUM,
+} LogEvent;
+
+// fixed size, the formatting is left to the drainer thread
+typedef struct
+{
+    uint64_t timestamp_ns;
+    uint32_t event;
+    int64_t args[EVENT_LOG_ARGS];
+} LogRecord;
+
+// this process's segment of live_stats.h
+typedef struct
+{
+    LiveStats* shared;
+    char name[64];
+    uint64_t phase_begin_ns;
+    float phase_ms[TICK_PHASE_NUM];
+} LiveStatsWriter;
+
+// awake npcs think and steer every tick, sleeping ones are kept apart and
+// only a slice of them per tick watches for the player
+typedef struct
+{
+    thing_idx npcs[MAX_THINGS]; // awake
+    size_t npc_num;
+    thing_idx dormant[MAX_THINGS];
+    size_t dormant_num;
+    size_t dormant_cursor;
+    size_t slot_of[MAX_THINGS]; // slot + 1 in npcs or dormant, 0 if the thing isn't a npc
+    size_t cursor;         // round robin start, a npc cut off by the budget goes first next tick
+    size_t think_interval;
+    uint64_t budget_ns;
+    size_t thinks_last_tick;
+} AiScheduler;
+
+typedef struct
+{
+    size_t due_tick;
+    thing_idx idx;
+} TypingEvent;
+
+// min heap of pending npc keystrokes, at most one per thing; heap_pos lets a
+// thing's keystroke be replaced or cancelled without searching
+typedef struct
+{
+    TypingEvent events[MAX_THINGS];
+    size_t event_num;
+    size_t heap_pos[MAX_THINGS]; // position + 1, 0 if the thing has no keystroke pending
+} TypingQueue;
+
+// two level hierarchical timing wheel of state expiries. Things are linked
+// into slot lists by index, so the wheel survives copying the Game around
+typedef struct
+{
+    thing_idx heads[TIMER_WHEEL_SLOTS + TIMER_WHEEL_COARSE_SLOTS];
+    thing_idx next[MAX_THINGS];
+    thing_idx prev[MAX_THINGS];
+    size_t slot_of[MAX_THINGS]; // slot + 1, 0 if the thing has no timer
+    size_t now; // first tick that wasn't processed yet
+} TimerWheel;
+
+// things that need per tick work. Idle, resting things are taken out and
+// only drawn until a transition, a hit or an ai decision wakes them up
+typedef struct
+{
+    thing_idx active[MAX_THINGS];
+    size_t active_num;
+    bool asleep[MAX_THINGS];
+} Activity;
+
+// uniform spatial hash of the npcs, rebuilt every tick with a counting sort
+// so every cell's members sit next to each other in the xs/ys arrays
+typedef struct
+{
+    uint32_t cell_start[CROWD_HASH_SIZE + 1];
+    uint32_t cell_of[MAX_THINGS]; // per ai member
+    float xs[MAX_THINGS];
+    float ys[MAX_THINGS];
+    thing_idx sorted[MAX_THINGS];
+    size_t member_num;
+    Vector2 push[MAX_THINGS]; // per thing, WORLD_UNIT per second
+} Crowd;
+
 typedef struct 
 {
     Thing things[MAX_THINGS];
     Animation animations[MAX_ANIMATIONS];
+    FrameBoxes frame_boxes[MAX_FRAME_BOXES];
+    size_t frame_box_num;
     char hit_text[HIT_TEXT_CAPACITY];
     char key_pressed;
+    uint8_t held_keys;
     int recorded_num;
     char input[HIT_TEXT_CAPACITY];
     thing_idx player_idx;
-    thing_idx thing_num;
+    thing_idx thing_num;               // highest slot in use, despawned slots below it are free
+    thing_idx free_things[MAX_THINGS]; // despawned slots, the next spawns reuse them
+    size_t free_thing_num;
     size_t animation_num;
+    InputQueue input_queue;
+    LatencyTracker latency;
+    Telemetry telemetry;
+    AiScheduler ai;
+    TypingQueue typing;
+    TimerWheel timers;
+    Activity activity;
+    Crowd crowd;
+    AssetCache assets;
+    Palettes palettes;
+    Resources resources;
+    Manifest manifest;
+    size_t tick;
 } Game;
 
-size_t get_first_char_idx(char* arr, size_t len);
-size_t get_damage_to_take(Thing* thing)
+const char* THING_KIND_NAMES[THING_KIND_NUM] = {
+    [DEFAULT_THING_KIND] = "default",
+    [KNIGHT] = "knight",
+    [ORC] = "orc",
+    [YAMABUSHI] = "yamabushi",
+    [GRID_CELL] = "grid cell",
+};
+
+const char* IMAGE_KIND_NAMES[IMAGE_KIND_NUM] = {
+    [DEFAULT_IMAGE] = "default",
+    [IDLE_IMAGE] = "idle",
+    [ATTACK_IMAGE] = "attack",
+    [WALK_IMAGE] = "walk",
+    [JUMP_IMAGE] = "jump",
+    [HURT_IMAGE] = "hurt",
+    [DEAD_IMAGE] = "dead",
+};
+
+const char* DURATION_NAMES[DURATION_NUM] = {
+    [DURATION_IDLE] = "idle",
+    [DURATION_INPUT] = "input",
+    [DURATION_HIT] = "hit",
+    [DURATION_WALK] = "walk",
+    [DURATION_FLY] = "fly",
+    [DURATION_DEFEND] = "defend",
+    [DURATION_DAMAGE] = "damage",
+};
+
+// bit i of Attributes
+const char* ATTRIBUTE_NAMES[] = {
+    "IDLING",
+    "HITTING",
+    "MOVING",
+    "LOOKS_LEFT",
+    "INPUTTING",
+    "MOVING_FAST",
+    "INPUT_MOVE",
+    "TAKING_OFF",
+    "DEFENDING",
+    "TAKING_DAMAGE",
+    "IN_THE_AIR",
+    "FALLING",
+};
+
+// STATE_NAMES live in live_stats.h for the reader
+_Static_assert(LIVE_STATS_STATES == STATE_NUM, "live_stats.h names every state");
+_Static_assert(DEATH == LIVE_STATS_STATES - 1, "live_stats.h names the states in order");
+
+// bit i of Traits
+const char* TRAIT_NAMES[] = {
+    "positionable",
+    "controllable",
+    "can_move",
+    "has_direction",
+    "can_hit",
+    "npc",
+    "enemy",
+    "can_fly",
+};
+
+// written by nob from the manifest, see emit_kind_tables
+#ifdef KIND_TABLES
+#include "build/kind_tables.h"
+#endif
+
+const char* LATENCY_STAGE_NAMES[LATENCY_STAGE_NUM] = {
+    [LATENCY_CONSUMED] = "consumed",
+    [LATENCY_STATE] = "state",
+    [LATENCY_PRESENTED] = "presented",
+};
+
+uint64_t now_ns(void)
 {
-    int damage_to_take = 0;
-    for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) 
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+size_t latency_bucket(uint64_t us)
+{
+    if (us < LATENCY_SUB_BUCKETS) return us;
+    int log2 = 63 - __builtin_clzll(us);
+    if (log2 > LATENCY_MAX_US_LOG2) return LATENCY_BUCKET_NUM - 1;
+    size_t sub = (us >> (log2 - LATENCY_SUB_BUCKETS_LOG2)) & (LATENCY_SUB_BUCKETS - 1);
+    return (log2 - LATENCY_SUB_BUCKETS_LOG2 + 1)*LATENCY_SUB_BUCKETS + sub;
+}
+
+// lowest value that falls into the bucket
+uint64_t latency_bucket_floor_us(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+    size_t log2 = bucket/LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS_LOG2 - 1;
+    size_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return (1ull << log2) + ((uint64_t)sub << (log2 - LATENCY_SUB_BUCKETS_LOG2));
+}
+
+void latency_record(LatencyHistogram* hist, uint64_t us)
+{
+    hist->buckets[latency_bucket(us)]++;
+    hist->count++;
+    hist->sum_us += us;
+    hist->max_us = MAX(hist->max_us, us);
+}
+
+uint64_t latency_percentile_us(LatencyHistogram* hist, float percentile)
+{
+    if (hist->count == 0) return 0;
+    uint64_t rank = (uint64_t)ceilf(percentile/100.0f * hist->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_NUM; i++)
     {
-        if(thing->defend_text[char_idx] != 0) damage_to_take++;
+        seen += hist->buckets[i];
+        if (seen >= rank) return latency_bucket_floor_us(i);
     }
-    return damage_to_take;
+    return hist->max_us;
 }
 
-void print_debug_attributes(Attributes attr)
+void latency_begin_frame(Game* game, uint64_t input_ns)
 {
-    if (attr == DEFAULT_ATTR)
+    game->latency.input_ns = input_ns;
+    for (size_t i = 0; i < LATENCY_STAGE_NUM; i++) game->latency.marked[i] = false;
+}
+
+// only the first mark of a stage per keystroke counts
+void latency_mark(Game* game, LatencyStage stage)
+{
+    LatencyTracker* latency = &game->latency;
+    if (latency->input_ns == 0 || latency->marked[stage]) return;
+    latency->marked[stage] = true;
+    latency_record(&latency->stages[stage], (now_ns() - latency->input_ns)/1000);
+}
+
+// a keystroke of the player while a target key was expected
+void telemetry_key(Game* game, TelemetryMode mode, char expected, char typed, size_t state_start)
+{
+    Telemetry* telemetry = &game->telemetry;
+    KeyTelemetry* key = &telemetry->keys[(unsigned char)expected % TELEMETRY_KEYS];
+    // the target appeared with the state or with the previous keystroke
+    size_t since = MAX(telemetry->last_key_tick, state_start);
+    latency_record(&key->reaction, (uint64_t)(game->tick - since)*1000000/FRAMERATE);
+    telemetry->last_key_tick = game->tick;
+    if (typed != expected)
     {
-        TraceLog(LOG_INFO, "attrs: DEFAULT_ATTR");
+        key->misses[mode]++;
         return;
     }
-    TraceLog(LOG_INFO, "attrs mask: 0x%X", attr);
-    for (int bit = 0; bit < 32; bit++)
+    key->hits[mode]++;
+    if (telemetry->window_num == TELEMETRY_CPM_WINDOW_TICKS) return;
+    telemetry->window[(telemetry->window_head + telemetry->window_num) % TELEMETRY_CPM_WINDOW_TICKS] = game->tick;
+    telemetry->window_num++;
+}
+
+// slides the cpm window to the current tick
+void telemetry_tick(Game* game)
+{
+    Telemetry* telemetry = &game->telemetry;
+    while (telemetry->window_num > 0 && telemetry->window[telemetry->window_head] + TELEMETRY_CPM_WINDOW_TICKS <= game->tick)
+    {
+        telemetry->window_head = (telemetry->window_head + 1) % TELEMETRY_CPM_WINDOW_TICKS;
+        telemetry->window_num--;
+    }
+    if (telemetry->window_num == 0)
+    {
+        telemetry->cpm = 0.0f;
+        return;
+    }
+    telemetry->cpm = telemetry->window_num*60.0f*FRAMERATE/TELEMETRY_CPM_WINDOW_TICKS;
+    telemetry->peak_cpm = MAX(telemetry->peak_cpm, telemetry->cpm);
+    telemetry->typing_ticks++;
+    if (telemetry->cpm >= GOOD_CPM) telemetry->good_ticks++;
+}
+
+void telemetry_totals(Telemetry* telemetry, uint64_t* hits, uint64_t* misses)
+{
+    *hits = 0;
+    *misses = 0;
+    for (size_t i = 0; i < TELEMETRY_KEYS; i++)
     {
-        int flag = 1 << bit;
-        if ((attr & flag) == 0) continue;
-        switch (flag)
+        for (TelemetryMode mode = 0; mode < TELEMETRY_MODE_NUM; mode++)
         {
-            case IDLING: TraceLog(LOG_INFO, "  IDLING"); break;
-            case HITTING: TraceLog(LOG_INFO, "  HITTING"); break;
-            case MOVING: TraceLog(LOG_INFO, "  MOVING"); break;
-            case LOOKS_LEFT: TraceLog(LOG_INFO, "  LOOKS_LEFT"); break;
-            case INPUTTING: TraceLog(LOG_INFO, "  INPUTTING"); break;
-            case MOVING_FAST: TraceLog(LOG_INFO, "  MOVING_FAST"); break;
-            case INPUT_MOVE: TraceLog(LOG_INFO, "  INPUT_MOVE"); break;
-            // case FLYING: TraceLog(LOG_INFO, "  FLYING"); break;
-            case DEFENDING: TraceLog(LOG_INFO, "  DEFENDING"); break;
-            case TAKING_DAMAGE: TraceLog(LOG_INFO, "  TAKING_DAMAGE"); break;
-            default: TraceLog(LOG_INFO, "  UNKNOWN_FLAG(0x%X)", flag); break;
+            *hits += telemetry->keys[i].hits[mode];
+            *misses += telemetry->keys[i].misses[mode];
         }
     }
 }
 
-
-void state_transition(Game* game, thing_idx idx, State state)
+bool telemetry_write(Game* game, const char* path)
 {
-    Thing* thing = &game->things[idx];
-    thing->state_cnt = 0;
-    game->key_pressed = 0;
-    game->recorded_num = 0;
-    thing->state = state;
+    Telemetry* telemetry = &game->telemetry;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "TELEMETRY: can't write %s: %s", path, strerror(errno));
+        return false;
+    }
+    TelemetryHeader header = {
+        .magic = TELEMETRY_MAGIC,
+        .version = TELEMETRY_VERSION,
+        .frame_ms = (uint32_t)MS_PER_FRAME,
+        .ticks = (uint32_t)game->tick,
+        .good_cpm = GOOD_CPM,
+        .good_ticks = (uint32_t)telemetry->good_ticks,
+        .typing_ticks = (uint32_t)telemetry->typing_ticks,
+        .peak_cpm = telemetry->peak_cpm,
+    };
+    for (size_t i = 0; i < TELEMETRY_KEYS; i++) if (telemetry->keys[i].reaction.count > 0) header.key_num++;
+    fwrite(&header, sizeof(header), 1, file);
+    for (size_t i = 0; i < TELEMETRY_KEYS; i++)
+    {
+        KeyTelemetry* key = &telemetry->keys[i];
+        if (key->reaction.count == 0) continue;
+        TelemetryKey record = {.key = (uint32_t)i, .sum_us = key->reaction.sum_us, .max_us = key->reaction.max_us};
+        memcpy(record.hits, key->hits, sizeof(record.hits));
+        memcpy(record.misses, key->misses, sizeof(record.misses));
+        for (size_t b = 0; b < LATENCY_BUCKET_NUM; b++) if (key->reaction.buckets[b] > 0) record.bucket_num++;
+        fwrite(&record, sizeof(record), 1, file);
+        for (size_t b = 0; b < LATENCY_BUCKET_NUM; b++)
+        {
+            if (key->reaction.buckets[b] == 0) continue;
+            TelemetryBucket bucket = {.bucket = (uint32_t)b, .count = (uint32_t)key->reaction.buckets[b]};
+            fwrite(&bucket, sizeof(bucket), 1, file);
+        }
+    }
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    if (!ok) TraceLog(LOG_ERROR, "TELEMETRY: writing %s failed", path);
+    return ok;
 }
 
-bool check_bitmask(int bitmask, int flag)
+void print_telemetry(Game* game)
 {
-    return (bitmask & flag) != 0;
+    Telemetry* telemetry = &game->telemetry;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    telemetry_totals(telemetry, &hits, &misses);
+    if (hits + misses == 0) return;
+    TraceLog(LOG_INFO, "TELEMETRY: %llu keystrokes, accuracy %.1f%%, peak %.0f cpm, %.0f%% of the typing time at %d cpm or more",
+             (unsigned long long)(hits + misses), 100.0*hits/(hits + misses), telemetry->peak_cpm,
+             telemetry->typing_ticks ? 100.0*telemetry->good_ticks/telemetry->typing_ticks : 0.0, GOOD_CPM);
 }
 
-int count_bits(int x) {
-    int count = 0;
-    while (x) {
-        count += x & 1;
-        x >>= 1;
+bool latency_export(LatencyTracker* latency, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "could not open %s: %s", path, strerror(errno));
+        return false;
     }
-    return count;
+    fprintf(file, "stage,bucket_floor_us,count\n");
+    for (size_t stage = 0; stage < LATENCY_STAGE_NUM; stage++)
+    {
+        LatencyHistogram* hist = &latency->stages[stage];
+        for (size_t i = 0; i < LATENCY_BUCKET_NUM; i++)
+        {
+            if (hist->buckets[i] == 0) continue;
+            fprintf(file, "%s,%llu,%llu\n", LATENCY_STAGE_NAMES[stage], (unsigned long long)latency_bucket_floor_us(i), (unsigned long long)hist->buckets[i]);
+        }
+    }
+    fclose(file);
+    TraceLog(LOG_INFO, "latency histograms written to %s", path);
+    return true;
 }
 
-int set_bit(int bitmask, int flag)
+// gives the calling thread a ring of the drainer, NULL once every ring is taken
+SpscRing* drain_claim(Drainer* drainer, const char* name)
 {
-    return bitmask | flag;
+    size_t slot = atomic_fetch_add(&drainer->ring_num, 1);
+    if (slot >= drainer->max_rings) return NULL;
+    SpscRing* ring = &drainer->rings[slot];
+    ring->records = drainer->records + slot*drainer->capacity*drainer->record_size;
+#ifdef __linux__
+    ring->tid = (int)syscall(SYS_gettid);
+#else
+    ring->tid = (int)slot + 1;
+#endif
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    atomic_store_explicit(&ring->ready, true, memory_order_release);
+    return ring;
 }
 
-int clear_bit(int bitmask, int flag)
+// where the next record goes, NULL if the ring is full and it is dropped.
+// Nothing is visible to the drainer until drain_push_end
+void* drain_push_begin(Drainer* drainer, SpscRing* ring)
 {
-    return bitmask & ~flag;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == drainer->capacity)
+    {
+        ring->dropped++;
+        return NULL;
+    }
+    return ring->records + (head % drainer->capacity)*drainer->record_size;
 }
 
-int toggle_bit(int bitmask, int flag)
+void drain_push_end(SpscRing* ring)
 {
-    return bitmask ^ flag;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 }
 
-void init_animation(
-    Animation* anim,
-    Attributes attr,
-    SpriteSet sprite_set,
-    // size_t sprite_idx,
-    size_t duration_frames
-)
+#ifdef __linux__
+// formats everything the threads pushed since the last drain
+void drain_rings(Drainer* drainer)
 {
-    anim->kind = sprite_set.kind;
-    anim->attr = attr;
-    anim->duration_frames = duration_frames;
-}
-
+    size_t ring_num = MIN(atomic_load(&drainer->ring_num), drainer->max_rings);
+    for (size_t i = 0; i < ring_num; i++)
+    {
+        SpscRing* ring = &drainer->rings[i];
+        if (!atomic_load_explicit(&ring->ready, memory_order_acquire)) continue;
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        for (; tail != head; tail++)
+        {
+            drainer->format(drainer, ring, ring->records + (tail % drainer->capacity)*drainer->record_size);
+            drainer->written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+// formatting and writing happen here, the recording threads only copy a record
+void* drain_thread(void* arg)
+{
+    Drainer* drainer = arg;
+    while (!atomic_load(&drainer->quit))
+    {
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = drainer->interval_ns};
+        nanosleep(&ts, NULL);
+        drain_rings(drainer);
+    }
+    drain_rings(drainer);
+    return NULL;
+}
+
+bool drain_start(Drainer* drainer, const char* path)
+{
+    drainer->file = fopen(path, "w");
+    if (drainer->file == NULL)
+    {
+        TraceLog(LOG_ERROR, "%s: can't write %s: %s", drainer->prefix, path, strerror(errno));
+        return false;
+    }
+    drainer->path = path;
+    drainer->start_ns = now_ns();
+    if (drainer->header != NULL) drainer->header(drainer);
+    if (pthread_create(&drainer->thread, NULL, drain_thread, drainer) != 0)
+    {
+        TraceLog(LOG_ERROR, "%s: can't start the drainer thread", drainer->prefix);
+        fclose(drainer->file);
+        drainer->file = NULL;
+        return false;
+    }
+    atomic_store(&drainer->enabled, true);
+    return true;
+}
+
+// records still being pushed by threads that outlive this are lost
+void drain_stop(Drainer* drainer)
+{
+    if (drainer->file == NULL) return;
+    atomic_store(&drainer->enabled, false);
+    atomic_store(&drainer->quit, true);
+    pthread_join(drainer->thread, NULL);
+    if (drainer->footer != NULL) drainer->footer(drainer);
+    fclose(drainer->file);
+    drainer->file = NULL;
+    size_t dropped = 0;
+    for (size_t i = 0; i < MIN(atomic_load(&drainer->ring_num), drainer->max_rings); i++) dropped += drainer->rings[i].dropped;
+    if (dropped > 0) TraceLog(LOG_WARNING, "%s: dropped %zu %s, a ring filled up between two drains", drainer->prefix, dropped, drainer->unit);
+    TraceLog(LOG_INFO, "%s: wrote %zu %s to %s", drainer->prefix, drainer->written, drainer->unit, drainer->path);
+}
+#endif //__linux__
+
+void trace_header(Drainer* drainer);
+void trace_format(Drainer* drainer, SpscRing* ring, const void* record);
+void trace_footer(Drainer* drainer);
+
+// global so worker threads can record zones without a Game
+SpscRing trace_rings[TRACE_MAX_THREADS];
+TraceEvent trace_events[TRACE_MAX_THREADS][TRACE_BUFFER_EVENTS];
+Drainer tracer = {
+    .prefix = "TRACE",
+    .unit = "zones",
+    .rings = trace_rings,
+    .max_rings = TRACE_MAX_THREADS,
+    .records = (unsigned char*)trace_events,
+    .record_size = sizeof(TraceEvent),
+    .capacity = TRACE_BUFFER_EVENTS,
+    .interval_ns = TRACE_FLUSH_INTERVAL_NS,
+    .header = trace_header,
+    .format = trace_format,
+    .footer = trace_footer,
+};
+int trace_pid;
+_Thread_local SpscRing* trace_ring = NULL;
+_Thread_local bool trace_claimed = false;
+_Thread_local ZoneStack zones;
+
+// gives the calling thread a ring and a name in the trace, threads that
+// open a zone without calling it are named "worker"
+void trace_thread(const char* name)
+{
+    if (trace_claimed) return;
+    trace_claimed = true;
+    trace_ring = drain_claim(&tracer, name);
+    if (trace_ring == NULL) TraceLog(LOG_WARNING, "TRACE: more than %d threads, %s isn't recorded", TRACE_MAX_THREADS, name);
+}
+
+// zones nest per thread, every trace_begin needs its trace_end
+void trace_begin(const char* name)
+{
+    bool tracing = atomic_load_explicit(&tracer.enabled, memory_order_relaxed);
+#ifndef ALLOC_TRACKING
+    // the allocation tracker needs the zones even when nothing is traced
+    if (!tracing) return;
+#endif
+    if (zones.depth < TRACE_MAX_DEPTH)
+    {
+        zones.names[zones.depth] = name;
+        zones.begin_ns[zones.depth] = tracing ? now_ns() : 0;
+        zones.allocs[zones.depth] = 0;
+    }
+    zones.depth++;
+    if (tracing && !trace_claimed) trace_thread("worker");
+}
+
+// innermost open zone of the thread, NULL outside of every zone
+const char* trace_zone(void)
+{
+    if (zones.depth == 0) return NULL;
+    return zones.names[MIN(zones.depth, (size_t)TRACE_MAX_DEPTH) - 1];
+}
+
+void trace_end(void)
+{
+    if (zones.depth == 0) return;
+    zones.depth--;
+    SpscRing* ring = trace_ring;
+    if (zones.depth >= TRACE_MAX_DEPTH || ring == NULL || zones.begin_ns[zones.depth] == 0) return;
+    uint64_t end_ns = now_ns();
+    TraceEvent* event = drain_push_begin(&tracer, ring);
+    if (event == NULL) return;
+    *event = (TraceEvent){
+        .name = zones.names[zones.depth],
+        .begin_ns = zones.begin_ns[zones.depth],
+        .end_ns = end_ns,
+    };
+    drain_push_end(ring);
+}
+
+void trace_header(Drainer* drainer)
+{
+    trace_pid = (int)getpid();
+    fprintf(drainer->file, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"keyboard fighter\"}}", trace_pid);
+}
+
+void trace_format(Drainer* drainer, SpscRing* ring, const void* record)
+{
+    const TraceEvent* event = record;
+    if (!ring->named)
+    {
+        fprintf(drainer->file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                trace_pid, ring->tid, ring->name);
+        ring->named = true;
+    }
+    fprintf(drainer->file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            event->name, trace_pid, ring->tid,
+            (event->begin_ns - drainer->start_ns)/1e3, (event->end_ns - event->begin_ns)/1e3);
+}
+
+void trace_footer(Drainer* drainer)
+{
+    fprintf(drainer->file, "\n]}\n");
+}
+
+#ifdef __linux__
+bool trace_start(const char* path)
+{
+    trace_thread("main");
+    if (!drain_start(&tracer, path)) return false;
+    TraceLog(LOG_INFO, "TRACE: recording zones to %s", path);
+    return true;
+}
+
+// zones still open or closed by threads that outlive this are lost
+void trace_stop(void)
+{
+    drain_stop(&tracer);
+}
+#else
+void trace_stop(void) {}
+bool trace_start(const char* path)
+{
+    (void)path;
+    TraceLog(LOG_WARNING, "TRACE: only supported on linux");
+    return false;
+}
+#endif //__linux__
+
+#ifdef ALLOC_TRACKING
+// ./nob -alloc-tracking links every malloc, calloc, realloc and free of the
+// game and raylib through the wrappers below
+AllocZone alloc_zones[ALLOC_MAX_ZONES];
+
+// zone names are static strings, a zone claims the first free slot
+AllocZone* alloc_zone(const char* name)
+{
+    if (name == NULL) name = "(no zone)";
+    for (size_t i = 0; i + 1 < ALLOC_MAX_ZONES; i++)
+    {
+        AllocZone* zone = &alloc_zones[i];
+        const char* current = atomic_load(&zone->name);
+        if (current == NULL && atomic_compare_exchange_strong(&zone->name, &current, name)) return zone;
+        if (current == name || strcmp(current, name) == 0) return zone;
+    }
+    // the last slot collects the zones that didn't fit
+    const char* overflow = NULL;
+    atomic_compare_exchange_strong(&alloc_zones[ALLOC_MAX_ZONES - 1].name, &overflow, "(other zones)");
+    return &alloc_zones[ALLOC_MAX_ZONES - 1];
+}
+
+void alloc_count(size_t bytes)
+{
+    AllocZone* zone = alloc_zone(trace_zone());
+    atomic_fetch_add_explicit(&zone->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&zone->bytes, bytes, memory_order_relaxed);
+    for (size_t depth = MIN(zones.depth, (size_t)TRACE_MAX_DEPTH); depth > 0; depth--)
+    {
+        zones.allocs[depth - 1]++;
+        if (strcmp(zones.names[depth - 1], ALLOC_EXEMPT_ZONE) == 0) break;
+    }
+}
+
+void alloc_count_free(void* ptr)
+{
+    if (ptr == NULL) return;
+    atomic_fetch_add_explicit(&alloc_zone(trace_zone())->frees, 1, memory_order_relaxed);
+}
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size)
+{
+    alloc_count(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    alloc_count(num*size);
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    alloc_count_free(ptr);
+    alloc_count(size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr)
+{
+    alloc_count_free(ptr);
+    __real_free(ptr);
+}
+
+void alloc_report(void)
+{
+    TraceLog(LOG_INFO, "ALLOC: %-20s %10s %10s %10s", "zone", "allocs", "KB", "frees");
+    for (size_t i = 0; i < ALLOC_MAX_ZONES; i++)
+    {
+        AllocZone* zone = &alloc_zones[i];
+        const char* name = atomic_load(&zone->name);
+        if (name == NULL) continue;
+        TraceLog(LOG_INFO, "ALLOC: %-20s %10llu %10llu %10llu", name,
+                 (unsigned long long)atomic_load(&zone->allocs),
+                 (unsigned long long)atomic_load(&zone->bytes)/1024,
+                 (unsigned long long)atomic_load(&zone->frees));
+    }
+}
+#else
+void alloc_report(void) {}
+#endif //ALLOC_TRACKING
+
+// TICK_PHASE_NAMES live in live_stats.h for the reader
+_Static_assert(LIVE_STATS_PHASES == TICK_PHASE_NUM, "live_stats.h has a slot per tick phase");
+_Static_assert(TICK_INCREMENT_GAME == LIVE_STATS_PHASES - 1, "live_stats.h names the phases in order");
+
+const char* COUNTER_NAMES[COUNTER_NUM] = {
+    [COUNTER_CYCLES] = "cycles",
+    [COUNTER_INSTRUCTIONS] = "instructions",
+    [COUNTER_L1D_MISSES] = "l1d misses",
+    [COUNTER_LLC_MISSES] = "llc misses",
+    [COUNTER_BRANCH_MISSES] = "branch misses",
+};
+
+PerfCounters perf;
+
+#ifdef __linux__
+int perf_open(uint32_t type, uint64_t config, int group)
+{
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group < 0; // members start with their leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// counts the calling thread only, counters the cpu lacks are left out
+bool perf_start(void)
+{
+    static const struct { uint32_t type; uint64_t config; } events[COUNTER_NUM] = {
+        [COUNTER_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [COUNTER_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [COUNTER_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        [COUNTER_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}, // last level on most cpus
+        [COUNTER_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    memset(&perf, 0, sizeof(perf));
+    perf.leader = -1;
+    int errors[COUNTER_NUM] = {0};
+    for (PerfCounter counter = 0; counter < COUNTER_NUM; counter++)
+    {
+        perf.slot[counter] = -1;
+        perf.fds[counter] = perf_open(events[counter].type, events[counter].config, perf.leader);
+        if (perf.fds[counter] < 0)
+        {
+            errors[counter] = errno;
+            continue;
+        }
+        if (perf.leader < 0) perf.leader = perf.fds[counter];
+        perf.slot[counter] = (int)perf.opened++;
+    }
+    if (perf.leader < 0)
+    {
+        // ENOENT without a pmu, in most vms, EACCES when perf_event_paranoid forbids it
+        TraceLog(LOG_WARNING, "PERF: no hardware counters: %s", strerror(errors[COUNTER_CYCLES]));
+        return false;
+    }
+    for (PerfCounter counter = 0; counter < COUNTER_NUM; counter++)
+    {
+        if (perf.fds[counter] < 0) TraceLog(LOG_WARNING, "PERF: no %s counter: %s", COUNTER_NAMES[counter], strerror(errors[counter]));
+    }
+    ioctl(perf.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    perf.enabled = true;
+    TraceLog(LOG_INFO, "PERF: counting %zu of %d counters", perf.opened, COUNTER_NUM);
+    return true;
+}
+
+// the whole group in one syscall
+bool perf_read(uint64_t* values)
+{
+    uint64_t data[3 + COUNTER_NUM]; // nr, time enabled, time running, values
+    ssize_t len = read(perf.leader, data, sizeof(data));
+    if (len < (ssize_t)((3 + perf.opened)*sizeof(uint64_t))) return false;
+    perf.time_enabled = data[1];
+    perf.time_running = data[2];
+    for (PerfCounter counter = 0; counter < COUNTER_NUM; counter++)
+    {
+        values[counter] = perf.slot[counter] < 0 ? 0 : data[3 + perf.slot[counter]];
+    }
+    return true;
+}
+
+// the global is zeroed, fds of counters never started are stdin
+void perf_stop(void)
+{
+    if (!perf.enabled) return;
+    for (PerfCounter counter = 0; counter < COUNTER_NUM; counter++)
+    {
+        if (perf.fds[counter] >= 0) close(perf.fds[counter]);
+        perf.fds[counter] = -1;
+    }
+    perf.enabled = false;
+}
+#else
+bool perf_start(void)
+{
+    TraceLog(LOG_WARNING, "PERF: only supported on linux");
+    return false;
+}
+bool perf_read(uint64_t* values) { (void)values; return false; }
+void perf_stop(void) {}
+#endif //__linux__
+
+// global like the tracer, phase_begin and phase_end time the phases for it
+LiveStatsWriter live;
+
+// things that exist, thing_num also covers the despawned slots below it
+size_t live_thing_num(Game* game)
+{
+    return game->thing_num - game->free_thing_num;
+}
+
+// the zone starts before and the counters stop before the tracer's own work
+void phase_begin(TickPhase phase)
+{
+    trace_begin(TICK_PHASE_NAMES[phase]);
+    if (live.shared != NULL) live.phase_begin_ns = now_ns();
+    if (perf.enabled && perf_read(perf.begin))
+    {
+        perf.begin_enabled = perf.time_enabled;
+        perf.begin_running = perf.time_running;
+    }
+}
+
+void phase_end(Game* game, TickPhase phase)
+{
+    uint64_t end[COUNTER_NUM];
+    if (perf.enabled && perf_read(end))
+    {
+        // a multiplexed group only counted while it ran, extrapolate each
+        // delta to the phase's enabled time like perf stat does
+        uint64_t enabled = perf.time_enabled - perf.begin_enabled;
+        uint64_t running = perf.time_running - perf.begin_running;
+        if (running == 0 && enabled > 0) perf.unscheduled_ticks++;
+        else
+        {
+            double scale = 1.0;
+            if (running < enabled)
+            {
+                scale = (double)enabled/running;
+                perf.scaled_ticks++;
+            }
+            for (PerfCounter counter = 0; counter < COUNTER_NUM; counter++) perf.totals[phase][counter] += (uint64_t)((end[counter] - perf.begin[counter])*scale + 0.5);
+            perf.ticks[phase]++;
+            perf.thing_ticks[phase] += live_thing_num(game);
+        }
+    }
+    if (live.shared != NULL) live.phase_ms[phase] = (now_ns() - live.phase_begin_ns)/1e6f;
+#ifdef ALLOC_TRACKING
+    // the phase and every zone inside it have to run on the fixed tables once
+    // the game is steady, only the loads it triggers may allocate
+    uint64_t allocs = (zones.depth > 0 && zones.depth <= TRACE_MAX_DEPTH) ? zones.allocs[zones.depth - 1] : 0;
+    if (game->tick >= ALLOC_STEADY_TICKS && allocs > 0)
+    {
+        TraceLog(LOG_ERROR, "ALLOC: %s made %llu allocations on tick %zu", TICK_PHASE_NAMES[phase], (unsigned long long)allocs, game->tick);
+        assert(allocs == 0 && "tick phases don't allocate in steady state");
+    }
+#endif
+    trace_end();
+}
+
+// a counter per thing and tick, n/a if the cpu doesn't count it
+void perf_format_per_thing(char* buffer, size_t size, TickPhase phase, PerfCounter counter)
+{
+    if (perf.slot[counter] < 0 || perf.thing_ticks[phase] == 0) snprintf(buffer, size, "n/a");
+    else snprintf(buffer, size, "%.3f", (double)perf.totals[phase][counter]/perf.thing_ticks[phase]);
+}
+
+void perf_report(void)
+{
+    if (!perf.enabled) return;
+    TraceLog(LOG_INFO, "PERF: %-15s %6s %12s %12s %12s %12s", "phase", "ipc", "cycles/tick", "l1d/thing", "llc/thing", "brmiss/thing");
+    for (TickPhase phase = 0; phase < TICK_PHASE_NUM; phase++)
+    {
+        if (perf.ticks[phase] == 0) continue;
+        uint64_t* totals = perf.totals[phase];
+        char ipc[16] = "n/a";
+        if (perf.slot[COUNTER_INSTRUCTIONS] >= 0 && totals[COUNTER_CYCLES] > 0) snprintf(ipc, sizeof(ipc), "%.2f", (double)totals[COUNTER_INSTRUCTIONS]/totals[COUNTER_CYCLES]);
+        char cycles[16] = "n/a";
+        if (perf.slot[COUNTER_CYCLES] >= 0) snprintf(cycles, sizeof(cycles), "%.0f", (double)totals[COUNTER_CYCLES]/perf.ticks[phase]);
+        char l1d[16], llc[16], branch[16];
+        perf_format_per_thing(l1d, sizeof(l1d), phase, COUNTER_L1D_MISSES);
+        perf_format_per_thing(llc, sizeof(llc), phase, COUNTER_LLC_MISSES);
+        perf_format_per_thing(branch, sizeof(branch), phase, COUNTER_BRANCH_MISSES);
+        TraceLog(LOG_INFO, "PERF: %-15s %6s %12s %12s %12s %12s", TICK_PHASE_NAMES[phase], ipc, cycles, l1d, llc, branch);
+    }
+    // the kernel time slices a group that doesn't fit the pmu with other users
+    if (perf.scaled_ticks > 0 || perf.unscheduled_ticks > 0)
+    {
+        TraceLog(LOG_WARNING, "PERF: counted %.0f%% of the time, %llu phases scaled up from a sample, %llu never counted and left out",
+                 perf.time_enabled ? 100.0*perf.time_running/perf.time_enabled : 0.0,
+                 (unsigned long long)perf.scaled_ticks, (unsigned long long)perf.unscheduled_ticks);
+    }
+}
+
+void log_format(Drainer* drainer, SpscRing* ring, const void* record_bytes);
+
+// global like the tracer, any thread may log
+SpscRing log_rings[EVENT_LOG_MAX_THREADS];
+LogRecord log_records[EVENT_LOG_MAX_THREADS][EVENT_LOG_RING_RECORDS];
+Drainer event_log = {
+    .prefix = "EVENTLOG",
+    .unit = "records",
+    .rings = log_rings,
+    .max_rings = EVENT_LOG_MAX_THREADS,
+    .records = (unsigned char*)log_records,
+    .record_size = sizeof(LogRecord),
+    .capacity = EVENT_LOG_RING_RECORDS,
+    .interval_ns = EVENT_LOG_FLUSH_INTERVAL_NS,
+    .format = log_format,
+};
+_Thread_local SpscRing* log_ring = NULL;
+_Thread_local bool log_claimed = false;
+
+// a copy into the thread's ring, cheap enough for every tick
+void log_event(LogEvent event, int64_t a, int64_t b, int64_t c, int64_t d)
+{
+    if (!atomic_load_explicit(&event_log.enabled, memory_order_relaxed)) return;
+    if (!log_claimed)
+    {
+        log_claimed = true;
+        log_ring = drain_claim(&event_log, "");
+    }
+    SpscRing* ring = log_ring;
+    if (ring == NULL) return;
+    LogRecord* record = drain_push_begin(&event_log, ring);
+    if (record == NULL) return;
+    *record = (LogRecord){
+        .timestamp_ns = now_ns(),
+        .event = event,
+        .args = {a, b, c, d},
+    };
+    drain_push_end(ring);
+}
+
+void log_format_attributes(FILE* file, int64_t attr)
+{
+    if (attr == DEFAULT_ATTR)
+    {
+        fprintf(file, " DEFAULT_ATTR");
+        return;
+    }
+    fprintf(file, " 0x%X", (unsigned)attr);
+    for (int bit = 0; bit < 32; bit++)
+    {
+        if ((attr & (1 << bit)) == 0) continue;
+        if (bit < (int)(sizeof(ATTRIBUTE_NAMES)/sizeof(ATTRIBUTE_NAMES[0]))) fprintf(file, " %s", ATTRIBUTE_NAMES[bit]);
+        else fprintf(file, " UNKNOWN_FLAG(0x%X)", 1u << bit);
+    }
+}
+
+const char* log_state_name(int64_t state)
+{
+    return (state >= 0 && state < STATE_NUM) ? STATE_NAMES[state] : "UNKNOWN_STATE";
+}
+
+void log_format(Drainer* drainer, SpscRing* ring, const void* record_bytes)
+{
+    const LogRecord* record = record_bytes;
+    FILE* file = drainer->file;
+    const int64_t* args = record->args;
+    fprintf(file, "%12.6f %6d ", (record->timestamp_ns - drainer->start_ns)/1e9, ring->tid);
+    switch (record->event)
+    {
+        case LOG_EVENT_ATTRIBUTES:
+            fprintf(file, "attrs");
+            log_format_attributes(file, args[0]);
+            break;
+        case LOG_EVENT_PLAYER_TICK:
+            fprintf(file, "tick %lld player age %lld duration %lld attrs", (long long)args[0], (long long)args[2], (long long)args[3]);
+            log_format_attributes(file, args[1]);
+            break;
+        case LOG_EVENT_STATE:
+            fprintf(file, "tick %lld thing %lld %s -> %s", (long long)args[0], (long long)args[1], log_state_name(args[2]), log_state_name(args[3]));
+            break;
+        default:
+            fprintf(file, "event %u %lld %lld %lld %lld", record->event, (long long)args[0], (long long)args[1], (long long)args[2], (long long)args[3]);
+            break;
+    }
+    fputc('\n', file);
+}
+
+#ifdef __linux__
+bool log_start(const char* path)
+{
+    if (!drain_start(&event_log, path)) return false;
+    TraceLog(LOG_INFO, "EVENTLOG: logging to %s", path);
+    return true;
+}
+
+void log_stop(void)
+{
+    drain_stop(&event_log);
+}
+#else
+bool log_start(const char* path)
+{
+    (void)path;
+    TraceLog(LOG_WARNING, "EVENTLOG: only supported on linux");
+    return false;
+}
+void log_stop(void) {}
+#endif //__linux__
+
+size_t get_first_char_idx(char* arr, size_t len);
+size_t get_damage_to_take(Thing* thing)
+{
+    int damage_to_take = 0;
+    for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) 
+    {
+        if(thing->defend_text[char_idx] != 0) damage_to_take++;
+    }
+    return damage_to_take;
+}
+
+void print_debug_attributes(Attributes attr)
+{
+    log_event(LOG_EVENT_ATTRIBUTES, attr, 0, 0, 0);
+}
+
+
+void typing_swap(TypingQueue* queue, size_t a, size_t b)
+{
+    TypingEvent tmp = queue->events[a];
+    queue->events[a] = queue->events[b];
+    queue->events[b] = tmp;
+    queue->heap_pos[queue->events[a].idx] = a + 1;
+    queue->heap_pos[queue->events[b].idx] = b + 1;
+}
+
+void typing_sift_up(TypingQueue* queue, size_t pos)
+{
+    while (pos > 0)
+    {
+        size_t parent = (pos - 1)/2;
+        if (queue->events[parent].due_tick <= queue->events[pos].due_tick) break;
+        typing_swap(queue, parent, pos);
+        pos = parent;
+    }
+}
+
+void typing_sift_down(TypingQueue* queue, size_t pos)
+{
+    for (;;)
+    {
+        size_t smallest = pos;
+        size_t left = 2*pos + 1;
+        size_t right = 2*pos + 2;
+        if (left < queue->event_num && queue->events[left].due_tick < queue->events[smallest].due_tick) smallest = left;
+        if (right < queue->event_num && queue->events[right].due_tick < queue->events[smallest].due_tick) smallest = right;
+        if (smallest == pos) break;
+        typing_swap(queue, smallest, pos);
+        pos = smallest;
+    }
+}
+
+void typing_cancel(TypingQueue* queue, thing_idx idx)
+{
+    size_t pos = queue->heap_pos[idx];
+    if (pos == 0) return;
+    pos--;
+    queue->heap_pos[idx] = 0;
+    queue->event_num--;
+    if (pos == queue->event_num) return;
+    queue->events[pos] = queue->events[queue->event_num];
+    queue->heap_pos[queue->events[pos].idx] = pos + 1;
+    typing_sift_up(queue, pos);
+    typing_sift_down(queue, pos);
+}
+
+void typing_schedule(TypingQueue* queue, thing_idx idx, size_t due_tick)
+{
+    typing_cancel(queue, idx);
+    assert(queue->event_num < MAX_THINGS);
+    size_t pos = queue->event_num++;
+    queue->events[pos] = (TypingEvent){.due_tick = due_tick, .idx = idx};
+    queue->heap_pos[idx] = pos + 1;
+    typing_sift_up(queue, pos);
+}
+
+float rand_float(void)
+{
+    return (float)rand()/(float)RAND_MAX;
+}
+
+float rand_gaussian(void)
+{
+    float u1 = MAX(rand_float(), 1e-6f);
+    float u2 = rand_float();
+    return sqrtf(-2.0f*logf(u1))*cosf(2.0f*PI*u2);
+}
+
+// frames until the npc's next keystroke, drawn around its mean typing speed
+size_t typing_interval_frames(Thing* thing)
+{
+    float cpm = (thing->cpm > 0.0f) ? thing->cpm : NPC_DEFAULT_CPM;
+    float jitter = (thing->cpm_jitter > 0.0f) ? thing->cpm_jitter : NPC_DEFAULT_CPM_JITTER;
+    float mean_frames = (60.0f*FRAMERATE)/cpm;
+    float frames = mean_frames*(1.0f + jitter*rand_gaussian());
+    if (frames < 1.0f) frames = 1.0f;
+    return (size_t)frames;
+}
+
+void timer_unlink(TimerWheel* wheel, thing_idx idx)
+{
+    size_t slot = wheel->slot_of[idx];
+    if (slot == 0) return;
+    slot--;
+    if (wheel->prev[idx] != 0) wheel->next[wheel->prev[idx]] = wheel->next[idx];
+    else wheel->heads[slot] = wheel->next[idx];
+    if (wheel->next[idx] != 0) wheel->prev[wheel->next[idx]] = wheel->prev[idx];
+    wheel->next[idx] = 0;
+    wheel->prev[idx] = 0;
+    wheel->slot_of[idx] = 0;
+}
+
+void timer_link(TimerWheel* wheel, thing_idx idx, size_t expire)
+{
+    size_t delta = expire - wheel->now;
+    size_t slot = 0;
+    if (delta < TIMER_WHEEL_SLOTS)
+    {
+        slot = expire % TIMER_WHEEL_SLOTS;
+    }
+    else
+    {
+        // farther than the coarse level reaches: park in the last coarse slot,
+        // cascading will put it back where it belongs
+        size_t coarse = MIN(delta >> TIMER_WHEEL_BITS, TIMER_WHEEL_COARSE_SLOTS - 1);
+        slot = TIMER_WHEEL_SLOTS + ((wheel->now >> TIMER_WHEEL_BITS) + coarse) % TIMER_WHEEL_COARSE_SLOTS;
+    }
+    wheel->prev[idx] = 0;
+    wheel->next[idx] = wheel->heads[slot];
+    if (wheel->heads[slot] != 0) wheel->prev[wheel->heads[slot]] = idx;
+    wheel->heads[slot] = idx;
+    wheel->slot_of[idx] = slot + 1;
+}
+
+void timer_schedule(Game* game, thing_idx idx, size_t expire)
+{
+    TimerWheel* wheel = &game->timers;
+    // the bucket of an already processed tick would only be looked at again a wheel turn later
+    if (expire < wheel->now) expire = wheel->now;
+    timer_unlink(wheel, idx);
+    timer_link(wheel, idx, expire);
+    game->things[idx].state_expire = expire;
+}
+
+// detach the list of things whose state ends on wheel->now and advance
+thing_idx timer_advance(Game* game)
+{
+    TimerWheel* wheel = &game->timers;
+    size_t now = wheel->now;
+    if (now % TIMER_WHEEL_SLOTS == 0)
+    {
+        size_t coarse_slot = TIMER_WHEEL_SLOTS + (now >> TIMER_WHEEL_BITS) % TIMER_WHEEL_COARSE_SLOTS;
+        thing_idx idx = wheel->heads[coarse_slot];
+        wheel->heads[coarse_slot] = 0;
+        while (idx != 0)
+        {
+            thing_idx next = wheel->next[idx];
+            wheel->slot_of[idx] = 0;
+            timer_link(wheel, idx, game->things[idx].state_expire);
+            idx = next;
+        }
+    }
+    size_t slot = now % TIMER_WHEEL_SLOTS;
+    thing_idx expired = wheel->heads[slot];
+    wheel->heads[slot] = 0;
+    for (thing_idx idx = expired; idx != 0; idx = wheel->next[idx]) wheel->slot_of[idx] = 0;
+    wheel->now = now + 1;
+    return expired;
+}
+
+size_t state_duration_frames(Game* game, thing_idx idx, State state);
+
+void ai_list_add(AiScheduler* ai, thing_idx* list, size_t* num, thing_idx idx)
+{
+    assert(*num < MAX_THINGS);
+    list[*num] = idx;
+    ai->slot_of[idx] = ++*num;
+}
+
+void ai_list_remove(AiScheduler* ai, thing_idx* list, size_t* num, thing_idx idx)
+{
+    size_t slot = ai->slot_of[idx] - 1;
+    list[slot] = list[--*num];
+    ai->slot_of[list[slot]] = slot + 1;
+    ai->slot_of[idx] = 0;
+    if (ai->cursor >= ai->npc_num) ai->cursor = 0;
+}
+
+void ai_sleep(Game* game, thing_idx idx)
+{
+    AiScheduler* ai = &game->ai;
+    if (ai->slot_of[idx] == 0) return;
+    ai_list_remove(ai, ai->npcs, &ai->npc_num, idx);
+    ai_list_add(ai, ai->dormant, &ai->dormant_num, idx);
+}
+
+void ai_wake(Game* game, thing_idx idx)
+{
+    AiScheduler* ai = &game->ai;
+    if (ai->slot_of[idx] == 0) return;
+    ai_list_remove(ai, ai->dormant, &ai->dormant_num, idx);
+    ai_list_add(ai, ai->npcs, &ai->npc_num, idx);
+}
+
+// awake npcs first, the dormant ones still take up room in the crowd
+thing_idx ai_member(AiScheduler* ai, size_t member)
+{
+    return member < ai->npc_num ? ai->npcs[member] : ai->dormant[member - ai->npc_num];
+}
+
+// a freshly spawned thing starts awake
+void activity_add(Game* game, thing_idx idx)
+{
+    Activity* activity = &game->activity;
+    assert(activity->active_num < MAX_THINGS);
+    activity->active[activity->active_num++] = idx;
+}
+
+void activity_remove(Game* game, thing_idx idx)
+{
+    Activity* activity = &game->activity;
+    activity->asleep[idx] = false;
+    size_t kept = 0;
+    for (size_t n = 0; n < activity->active_num; n++)
+    {
+        if (activity->active[n] != idx) activity->active[kept++] = activity->active[n];
+    }
+    activity->active_num = kept;
+}
+
+void activity_wake(Game* game, thing_idx idx)
+{
+    Activity* activity = &game->activity;
+    Thing* thing = &game->things[idx];
+    if (!activity->asleep[idx]) return;
+    activity->asleep[idx] = false;
+    activity_add(game, idx);
+    ai_wake(game, idx);
+    if (thing->state_expire != 0)
+    {
+        // keep the idle loop phase the draw code showed while sleeping
+        size_t period = thing->state_expire - thing->state_start;
+        thing->state_start = game->tick - (game->tick - thing->state_start) % period;
+        timer_schedule(game, idx, thing->state_start + period);
+    }
+}
+
+bool can_sleep(Game* game, Thing* thing)
+{
+    if ((thing->traits & CONTROLLABLE) == CONTROLLABLE) return false;
+    if (thing->state != IDLE) return false;
+    if (!Vector2Equals(thing->velocity, ZERO_VECTOR)) return false;
+    if (((thing->traits & CAN_MOVE) == CAN_MOVE) && (thing->position.y != STAGE_COORDINATE)) return false;
+    if ((thing->traits & NPC) == NPC)
+    {
+        Thing* player = &game->things[game->player_idx];
+        if (thing->ai_move) return false;
+        if (fabs(thing->position.x - player->position.x) <= NPC_DORMANT_DISTANCE) return false;
+    }
+    return true;
+}
+
+// drop things that went idle from the active list, keeping the order
+void activity_update(Game* game)
+{
+    Activity* activity = &game->activity;
+    size_t kept = 0;
+    for (size_t n = 0; n < activity->active_num; n++)
+    {
+        thing_idx idx = activity->active[n];
+        Thing* thing = &game->things[idx];
+        if (can_sleep(game, thing))
+        {
+            activity->asleep[idx] = true;
+            timer_unlink(&game->timers, idx);
+            ai_sleep(game, idx);
+            continue;
+        }
+        activity->active[kept++] = idx;
+    }
+    activity->active_num = kept;
+}
+
+size_t state_age(Game* game, Thing* thing)
+{
+    return game->tick - thing->state_start;
+}
+
+void state_transition(Game* game, thing_idx idx, State state)
+{
+    Thing* thing = &game->things[idx];
+    activity_wake(game, idx);
+    thing->state_start = game->tick;
+    size_t duration = state_duration_frames(game, idx, state);
+    if (duration != 0) timer_schedule(game, idx, game->tick + duration);
+    else
+    {
+        // kinds without animations (grid cells) never leave their state
+        timer_unlink(&game->timers, idx);
+        thing->state_expire = 0;
+    }
+    game->key_pressed = 0;
+    game->recorded_num = 0;
+    log_event(LOG_EVENT_STATE, game->tick, idx, thing->state, state);
+    thing->state = state;
+    if ((thing->traits & NPC) == NPC)
+    {
+        if (state == DEFEND) typing_schedule(&game->typing, idx, game->tick + typing_interval_frames(thing));
+        else typing_cancel(&game->typing, idx);
+    }
+}
+
+// end the current state on this tick's increment_game
+void state_expire(Game* game, thing_idx idx)
+{
+    timer_schedule(game, idx, game->tick);
+}
+
+bool check_bitmask(int bitmask, int flag)
+{
+    return (bitmask & flag) != 0;
+}
+
+int count_bits(int x) {
+    int count = 0;
+    while (x) {
+        count += x & 1;
+        x >>= 1;
+    }
+    return count;
+}
+
+int set_bit(int bitmask, int flag)
+{
+    return bitmask | flag;
+}
+
+int clear_bit(int bitmask, int flag)
+{
+    return bitmask & ~flag;
+}
+
+int toggle_bit(int bitmask, int flag)
+{
+    return bitmask ^ flag;
+}
+
+void init_animation(
+    Animation* anim,
+    Attributes attr,
+    SpriteSet sprite_set,
+    // size_t sprite_idx,
+    size_t duration_frames
+)
+{
+    anim->kind = sprite_set.kind;
+    anim->attr = attr;
+    anim->duration_frames = duration_frames;
+    // pixel art is drawn at a whole multiple of its native size, the one
+    // closest to THING_HEIGHT_DEFAULT, so point sampling drops no rows or columns
+    anim->scale = MAX(1.0f, roundf((float)THING_HEIGHT_DEFAULT/(float)sprite_set.figure_height));
+    anim->strike_frame = -1;
+    anim->palette = sprite_set.palette;
+}
+
+// writes 1 for every pixel of an rgba8 row that isn't transparent
+void alpha_scan_row(const unsigned char* rgba, int width, unsigned char* opaque)
+{
+    int x = 0;
+#ifdef __SSE2__
+    __m128i threshold = _mm_set1_epi32(ALPHA_THRESHOLD);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + 4*x));
+        __m128i alpha = _mm_srli_epi32(pixels, 24);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(alpha, threshold)));
+        opaque[x + 0] = (bits >> 0) & 1;
+        opaque[x + 1] = (bits >> 1) & 1;
+        opaque[x + 2] = (bits >> 2) & 1;
+        opaque[x + 3] = (bits >> 3) & 1;
+    }
+#endif //__SSE2__
+    for (; x < width; x++) opaque[x] = rgba[4*x + 3] > ALPHA_THRESHOLD;
+}
+
+// number of opaque pixels in every column of an rgba8 image region
+void alpha_column_profile(const Image* img, Rectangle region, int* counts)
+{
+    assert(img->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    int x0 = MAX((int)region.x, 0);
+    int y0 = MAX((int)region.y, 0);
+    int x1 = MIN((int)(region.x + region.width), img->width);
+    int y1 = MIN((int)(region.y + region.height), img->height);
+    memset(counts, 0, sizeof(int)*(size_t)region.width);
+    if (x1 <= x0 || y1 <= y0) return;
+    unsigned char* opaque = malloc(x1 - x0);
+    int offset = x0 - (int)region.x;
+    for (int y = y0; y < y1; y++)
+    {
+        alpha_scan_row((unsigned char*)img->data + 4*((size_t)y*img->width + x0), x1 - x0, opaque);
+        for (int x = 0; x < x1 - x0; x++) counts[offset + x] += opaque[x];
+    }
+    free(opaque);
+}
+
+// any pixel of the row opaque
+bool alpha_row_any(const unsigned char* rgba, int width)
+{
+    int x = 0;
+#ifdef __SSE2__
+    __m128i threshold = _mm_set1_epi32(ALPHA_THRESHOLD);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i alpha = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(rgba + 4*x)), 24);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi32(alpha, threshold))) return true;
+    }
+#endif //__SSE2__
+    for (; x < width; x++) if (rgba[4*x + 3] > ALPHA_THRESHOLD) return true;
+    return false;
+}
+
+// the body is the run of dense columns around the densest one, weapons
+// held in the resting pose are thin and fall below the cut
+bool body_columns(const Image* img, Rectangle frame, int* body_x0, int* body_x1)
+{
+    int width = frame.width;
+    int* counts = malloc(sizeof(int)*width);
+    alpha_column_profile(img, frame, counts);
+    int densest = 0;
+    for (int x = 0; x < width; x++) if (counts[x] > counts[densest]) densest = x;
+    bool found = counts[densest] > 0;
+    int cut = counts[densest]*2/5;
+    int x0 = densest;
+    int x1 = densest;
+    while (x0 > 0 && counts[x0 - 1] >= cut) x0--;
+    while (x1 + 1 < width && counts[x1 + 1] >= cut) x1++;
+    free(counts);
+    *body_x0 = (int)frame.x + x0;
+    *body_x1 = (int)frame.x + x1;
+    return found;
+}
+
+// frames of a sheet sit side by side in square cells. The opaque bounds of
+// every frame come from the alpha channel, the anchor is the center of its
+// body columns so frames stay registered on the body while weapons swing,
+// the width is the smallest one around it that keeps every opaque column.
+// The frames share the baseline of the lowest one, so a jump keeps its arc
+void detect_frames(Sprite* sprite, int default_width)
+{
+    Image* img = &sprite->image;
+    int cell = img->height;
+    if (sprite->frame_num == 0) sprite->frame_num = img->width/cell;
+    assert(sprite->frame_num != 0 && sprite->frame_num <= MAX_SPRITES_PER_SPRITE_SHEET);
+
+    int* counts = malloc(sizeof(int)*img->width);
+    alpha_column_profile(img, (Rectangle){0, 0, img->width, img->height}, counts);
+    sprite->baseline = 0;
+    for (size_t f = 0; f < sprite->frame_num; f++)
+    {
+        // a frame centered by hand is looked for in the cell of its anchor
+        int cell_x0 = (sprite->anchors[f] != 0) ? sprite->anchors[f]/cell*cell : (int)f*cell;
+        int x0 = cell_x0;
+        int x1 = MIN(cell_x0 + cell, img->width) - 1;
+        int y0 = 0;
+        int y1 = img->height - 1;
+        while (x0 <= x1 && counts[x0] == 0) x0++;
+        while (x1 >= x0 && counts[x1] == 0) x1--;
+        if (x0 > x1)
+        {
+            // an empty frame keeps its whole cell
+            x0 = cell_x0;
+            x1 = MIN(cell_x0 + cell, img->width) - 1;
+        }
+        else
+        {
+            unsigned char* left = (unsigned char*)img->data + 4*(size_t)x0;
+            while (y0 < y1 && !alpha_row_any(left + 4*(size_t)y0*img->width, x1 - x0 + 1)) y0++;
+            while (y1 > y0 && !alpha_row_any(left + 4*(size_t)y1*img->width, x1 - x0 + 1)) y1--;
+            sprite->baseline = MAX(sprite->baseline, y1 + 1);
+        }
+        Rectangle bounds = {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+        sprite->bounds[f] = bounds;
+        if (sprite->anchors[f] == 0)
+        {
+            int body_x0 = 0;
+            int body_x1 = 0;
+            if (body_columns(img, bounds, &body_x0, &body_x1)) sprite->anchors[f] = (body_x0 + body_x1 + 1)/2;
+            else sprite->anchors[f] = x0 + (x1 - x0 + 1)/2;
+        }
+        if (sprite->widths[f] == 0) sprite->widths[f] = default_width;
+        if (sprite->widths[f] != 0) continue;
+        int half = MAX(sprite->anchors[f] - x0, x1 + 1 - sprite->anchors[f]);
+        sprite->widths[f] = MAX(2*half, 2);
+    }
+    // a sheet without a single opaque pixel keeps its whole cells
+    if (sprite->baseline == 0) sprite->baseline = img->height;
+    free(counts);
+}
+
+void set_mask_cell(uint32_t* mask, Rectangle box, int x, int y)
+{
+    int cx = (int)((x - box.x)*FRAME_MASK_DIM/box.width);
+    int cy = (int)((y - box.y)*FRAME_MASK_DIM/box.height);
+    mask[MIN(cy, FRAME_MASK_DIM - 1)] |= 1u << MIN(cx, FRAME_MASK_DIM - 1);
+}
+
+// split a cropped frame into body (up to the front body column) and weapon
+// (ahead of it) and record tight boxes and coarse masks of both, a weapon
+// swung back behind the body does not strike
+void compute_frame_boxes(const Image* frame, int body_x1, bool strikes, FrameBoxes* boxes)
+{
+    assert(frame->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    memset(boxes, 0, sizeof(*boxes));
+    int w = frame->width;
+    int h = frame->height;
+    assert(w > 0 && h > 0);
+    unsigned char* opaque = malloc((size_t)w*h);
+    for (int y = 0; y < h; y++) alpha_scan_row((unsigned char*)frame->data + 4*(size_t)y*w, w, opaque + (size_t)y*w);
+
+    int hurt[4] = {w, h, -1, -1};
+    int hit[4] = {w, h, -1, -1};
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            if (!opaque[(size_t)y*w + x]) continue;
+            bool body = x <= body_x1;
+            if (!body && !strikes) continue;
+            int* bounds = body ? hurt : hit;
+            bounds[0] = MIN(bounds[0], x);
+            bounds[1] = MIN(bounds[1], y);
+            bounds[2] = MAX(bounds[2], x);
+            bounds[3] = MAX(bounds[3], y);
+        }
+    }
+    if (hurt[2] >= 0) boxes->hurtbox = (Rectangle){hurt[0], hurt[1], hurt[2] - hurt[0] + 1, hurt[3] - hurt[1] + 1};
+    if (hit[2] >= 0) boxes->hitbox = (Rectangle){hit[0], hit[1], hit[2] - hit[0] + 1, hit[3] - hit[1] + 1};
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            if (!opaque[(size_t)y*w + x]) continue;
+            bool body = x <= body_x1;
+            if (body) set_mask_cell(boxes->hurt_mask, boxes->hurtbox, x, y);
+            else if (strikes) set_mask_cell(boxes->hit_mask, boxes->hitbox, x, y);
+        }
+    }
+    free(opaque);
+}
+
+// fnv-1a over 64 bit words. The multiplies only carry bits upwards, the
+// murmur3 finalizer folds the high bits into the low ones the probes use
+uint64_t hash_pixels(const Image* img)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = (hash ^ (uint64_t)img->width) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)img->height) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)img->format) * 1099511628211ull;
+    const unsigned char* bytes = img->data;
+    size_t size = GetPixelDataSize(img->width, img->height, img->format);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash ? hash : 1;
+}
+
+// decoded rgba8 sheet of a path, the cache owns it
+Image* sheet_load(Game* game, const char* path)
+{
+    AssetCache* cache = &game->assets;
+    for (size_t i = 0; i < cache->sheet_num; i++)
+    {
+        if (strcmp(cache->sheets[i].path, path) != 0) continue;
+        cache->sheet_hits++;
+        return &cache->sheets[i].image;
+    }
+    assert(cache->sheet_num < MAX_SHEETS);
+    CachedSheet* sheet = &cache->sheets[cache->sheet_num++];
+    assert(strlen(path) < SHEET_PATH_CAPACITY);
+    strcpy(sheet->path, path);
+    trace_begin("LoadImage");
+    sheet->image = LoadImage(path);
+    assert(sheet->image.width != 0);
+    ImageFormat(&sheet->image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    trace_end();
+    sheet->hash = hash_pixels(&sheet->image);
+    sheet->owner = true;
+    for (size_t i = 0; i + 1 < cache->sheet_num; i++)
+    {
+        CachedSheet* other = &cache->sheets[i];
+        if (!other->owner || other->hash != sheet->hash) continue;
+        if (other->image.width != sheet->image.width || other->image.height != sheet->image.height) continue;
+        if (memcmp(other->image.data, sheet->image.data, 4*(size_t)sheet->image.width*sheet->image.height) != 0) continue;
+        UnloadImage(sheet->image);
+        sheet->image = other->image;
+        sheet->owner = false;
+        cache->sheet_hits++;
+        break;
+    }
+    return &sheet->image;
+}
+
+// a sheet decoded elsewhere, the cache takes ownership
+void sheet_cache_put(Game* game, const char* path, Image image)
+{
+    AssetCache* cache = &game->assets;
+    assert(cache->sheet_num < MAX_SHEETS);
+    assert(strlen(path) < SHEET_PATH_CAPACITY);
+    CachedSheet* sheet = &cache->sheets[cache->sheet_num++];
+    strcpy(sheet->path, path);
+    sheet->image = image;
+    sheet->hash = hash_pixels(&image);
+    sheet->owner = true;
+}
+
+void sheet_cache_release(Game* game)
+{
+    AssetCache* cache = &game->assets;
+    TraceLog(LOG_INFO, "ASSETS: %zu sheets (%zu shared), %zu unique frames (%zu shared)",
+             cache->sheet_num, cache->sheet_hits, cache->frame_num, cache->frame_hits);
+    for (size_t i = 0; i < cache->sheet_num; i++)
+    {
+        if (cache->sheets[i].owner) UnloadImage(cache->sheets[i].image);
+    }
+    cache->sheet_num = 0;
+}
+
+// texture of a sliced frame, uploaded once per distinct content
+Texture2D frame_texture(Game* game, const Image* frame)
+{
+    AssetCache* cache = &game->assets;
+    uint64_t hash = hash_pixels(frame);
+    size_t size = GetPixelDataSize(frame->width, frame->height, frame->format);
+    size_t mask = FRAME_CACHE_SIZE - 1;
+    size_t slot = hash & mask;
+    while (cache->frames[slot].hash != 0)
+    {
+        CachedFrame* cached = &cache->frames[slot];
+        if (cached->hash == hash && cached->width == frame->width && cached->height == frame->height && cached->texture.format == frame->format &&
+            memcmp(cached->pixels, frame->data, size) == 0)
+        {
+            cache->frame_hits++;
+            cached->refs++;
+            return cached->texture;
+        }
+        slot = (slot + 1) & mask;
+    }
+    assert(cache->frame_num < FRAME_CACHE_SIZE/2);
+    cache->frame_num++;
+    void* pixels = malloc(size);
+    assert(pixels != NULL);
+    memcpy(pixels, frame->data, size);
+    cache->frames[slot] = (CachedFrame){
+        .hash = hash,
+        .width = frame->width,
+        .height = frame->height,
+        .pixels = pixels,
+        .texture = texture_from_image(*frame),
+        .refs = 1,
+    };
+    cache->texture_bytes += size;
+    return cache->frames[slot].texture;
+}
+
+// drop one use of a frame texture, the last one unloads it
+void frame_texture_release(Game* game, Texture2D texture)
+{
+    AssetCache* cache = &game->assets;
+    size_t mask = FRAME_CACHE_SIZE - 1;
+    size_t slot = 0;
+    while (slot < FRAME_CACHE_SIZE && (cache->frames[slot].hash == 0 || cache->frames[slot].texture.id != texture.id)) slot++;
+    assert(slot < FRAME_CACHE_SIZE);
+    CachedFrame* cached = &cache->frames[slot];
+    assert(cached->refs > 0);
+    if (--cached->refs > 0) return;
+    cache->texture_bytes -= GetPixelDataSize(texture.width, texture.height, texture.format);
+    texture_unload(texture);
+    free(cached->pixels);
+    cache->frame_num--;
+    // backward shift deletion keeps every probe sequence unbroken
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; cache->frames[next].hash != 0; next = (next + 1) & mask)
+    {
+        size_t home = cache->frames[next].hash & mask;
+        if (((next - home) & mask) < ((next - hole) & mask)) continue;
+        cache->frames[hole] = cache->frames[next];
+        hole = next;
+    }
+    cache->frames[hole] = (CachedFrame){0};
+}
+
+const char* PALETTE_FRAGMENT_SHADER =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n" // palette indices in the red channel
+    "uniform sampler2D palette;\n"  // one palette per row
+    "out vec4 finalColor;\n"
+    "void main()\n"
+    "{\n"
+    "    int index = int(texture(texture0, fragTexCoord).r*255.0 + 0.5);\n"
+    "    int row = int(fragColor.r*255.0 + 0.5);\n" // the tint carries the palette row
+    "    finalColor = texelFetch(palette, ivec2(index, row), 0);\n"
+    "}\n";
+
+// index of a color in a palette, -1 if it isn't there
+int palette_find(const Color* palette, int color_num, Color color)
+{
+    if (color.a == 0) return 0;
+    for (int i = 1; i < color_num; i++)
+    {
+        if (palette[i].r == color.r && palette[i].g == color.g && palette[i].b == color.b && palette[i].a == color.a) return i;
+    }
+    return -1;
+}
+
+// the base sheets of a set are quantized to one palette, every variant
+// directory adds a row holding the color each index has in its recolor of
+// the same sheets. Sets with too many colors stay rgba
+void build_palettes(Game* game, SpriteSet* sprites)
+{
+    // a reload fills the rows the first load got
+    bool reload = sprites->palette >= 0;
+    size_t base = reload ? (size_t)sprites->palette : game->palettes.num;
+    sprites->palette = -1;
+    size_t variant_num = 0;
+    while (variant_num < MAX_PALETTE_VARIANTS && sprites->variants[variant_num] != NULL) variant_num++;
+    if (variant_num == 0) return;
+    Palettes* palettes = &game->palettes;
+    assert(base + 1 + variant_num <= MAX_PALETTES);
+    Color* colors = palettes->colors[base];
+    memset(colors, 0, sizeof(palettes->colors[0])*(1 + variant_num));
+
+    int color_num = 1;
+    for (ImageKind kind = 0; kind < IMAGE_KIND_NUM; kind++)
+    {
+        Image* img = &sprites->sprites[kind].image;
+        if (sprites->sprites[kind].image_path == NULL) continue;
+        Color* pixels = img->data;
+        for (size_t i = 0; i < (size_t)img->width*img->height; i++)
+        {
+            if (palette_find(colors, color_num, pixels[i]) >= 0) continue;
+            if (color_num == PALETTE_SIZE)
+            {
+                TraceLog(LOG_WARNING, "PALETTE: %s has more than %d colors, keeping rgba frames", sprites->sprites[kind].image_path, PALETTE_SIZE - 1);
+                return;
+            }
+            colors[color_num++] = pixels[i];
+        }
+    }
+
+    for (size_t v = 0; v < variant_num; v++)
+    {
+        Color* row = palettes->colors[base + 1 + v];
+        bool recolor = true;
+        for (ImageKind kind = 0; kind < IMAGE_KIND_NUM && recolor; kind++)
+        {
+            const char* path = sprites->sprites[kind].image_path;
+            if (path == NULL) continue;
+            const char* file = strrchr(path, '/');
+            Image* img = &sprites->sprites[kind].image;
+            Image* variant = sheet_load(game, TextFormat("%s/%s", sprites->variants[v], file ? file + 1 : path));
+            recolor = variant->width == img->width && variant->height == img->height;
+            Color* pixels = img->data;
+            Color* variant_pixels = variant->data;
+            for (size_t i = 0; recolor && i < (size_t)img->width*img->height; i++)
+            {
+                int index = palette_find(colors, color_num, pixels[i]);
+                Color color = variant_pixels[i];
+                if (index == 0) recolor = color.a == 0;
+                else if (row[index].a == 0) row[index] = color;
+                else recolor = memcmp(&row[index], &color, sizeof(color)) == 0;
+                recolor = recolor && (index == 0 || color.a != 0);
+            }
+        }
+        if (!recolor)
+        {
+            TraceLog(LOG_WARNING, "PALETTE: %s is not a recolor of the base sheets, using the base colors", sprites->variants[v]);
+            memcpy(row, colors, sizeof(palettes->colors[0]));
+        }
+    }
+    if (!reload) palettes->num += 1 + variant_num;
+    sprites->palette = base;
+    TraceLog(LOG_INFO, "PALETTE: %d colors, %zu variants in rows %zu..%zu", color_num - 1, variant_num, base, base + variant_num);
+}
+
+// palette indices of an rgba8 frame written into a caller owned buffer
+Image quantize_frame(const Image* frame, const Color* palette, unsigned char* buffer)
+{
+    assert(frame->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    Color* pixels = frame->data;
+    for (size_t i = 0; i < (size_t)frame->width*frame->height; i++)
+    {
+        int index = palette_find(palette, PALETTE_SIZE, pixels[i]);
+        assert(index >= 0);
+        buffer[i] = index;
+    }
+    return (Image){
+        .data = buffer,
+        .width = frame->width,
+        .height = frame->height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE,
+    };
+}
+
+void palette_upload(Game* game)
+{
+    Palettes* palettes = &game->palettes;
+    if (palettes->num == 0) return;
+    Image image = {
+        .data = palettes->colors,
+        .width = PALETTE_SIZE,
+        .height = MAX_PALETTES,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+    if (palettes->texture.id != 0)
+    {
+        texture_update(palettes->texture, image.data);
+        return;
+    }
+    palettes->texture = texture_from_image(image);
+    palettes->shader = shader_from_memory(NULL, PALETTE_FRAGMENT_SHADER);
+    palettes->texture_loc = shader_location(palettes->shader, "palette");
+}
+
+void begin_palette_mode(Game* game)
+{
+    BeginShaderMode(game->palettes.shader);
+    SetShaderValueTexture(game->palettes.shader, game->palettes.texture_loc, game->palettes.texture);
+}
+
+// view of a sheet region written into a caller owned rgba8 buffer, parts
+// of the region outside of the sheet or the clip are transparent
+Image slice_frame(const Image* sheet, Rectangle region, Rectangle clip, unsigned char* buffer)
+{
+    assert(sheet->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    Image frame = {
+        .data = buffer,
+        .width = region.width,
+        .height = region.height,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+    int x0 = MAX(MAX((int)region.x, (int)clip.x), 0);
+    int x1 = MIN(MIN((int)region.x + frame.width, (int)(clip.x + clip.width)), sheet->width);
+    size_t row_bytes = 4*(size_t)frame.width;
+    for (int y = 0; y < frame.height; y++)
+    {
+        unsigned char* dst = buffer + y*row_bytes;
+        int sheet_y = (int)region.y + y;
+        if (sheet_y < 0 || sheet_y >= sheet->height || x1 <= x0)
+        {
+            memset(dst, 0, row_bytes);
+            continue;
+        }
+        size_t left = 4*(size_t)(x0 - (int)region.x);
+        size_t span = 4*(size_t)(x1 - x0);
+        memset(dst, 0, left);
+        memcpy(dst + left, (unsigned char*)sheet->data + 4*((size_t)sheet_y*sheet->width + x0), span);
+        memset(dst + left + span, 0, row_bytes - left - span);
+    }
+    return frame;
+}
+
 size_t sprite_to_animation(
     Game* game,
     Traits traits, 
@@ -337,579 +2644,1839 @@ size_t sprite_to_animation(
     int* anchors // array indicates if anchor should be used or not
 )
 {
-    size_t animation_idx = game->animation_num++;
-    assert(animation_idx < MAX_ANIMATIONS);
-    Sprite* sprite = &sprite_set.sprites[sprite_idx]; 
-    // size_t anchors_num = sprite->frame_num;
-    Animation* anim = &game->animations[animation_idx];
-    Animation* inversed_anim = NULL;
-    init_animation(anim, attr, sprite_set, duration_frames);
-    if ((traits & HAS_DIRECTION) == HAS_DIRECTION)
+    trace_begin("sprite_to_animation");
+    size_t animation_idx = game->animation_num++;
+    assert(animation_idx < MAX_ANIMATIONS);
+    Sprite* sprite = &sprite_set.sprites[sprite_idx]; 
+    // size_t anchors_num = sprite->frame_num;
+    Animation* anim = &game->animations[animation_idx];
+    Animation* inversed_anim = NULL;
+    init_animation(anim, attr, sprite_set, duration_frames);
+    if ((traits & HAS_DIRECTION) == HAS_DIRECTION)
+    {
+        game->animation_num++;
+        assert(game->animation_num < MAX_ANIMATIONS);
+        inversed_anim = &game->animations[animation_idx + 1];
+        init_animation(inversed_anim, attr | LOOKS_LEFT, sprite_set, duration_frames);
+        inversed_anim->flipped = true;
+    }
+    Image* img = &sprite->image;
+    // only frames of the swing carry a hitbox
+    bool strikes = (attr & HITTING) == HITTING;
+    size_t boxes = game->frame_box_num;
+    float strike_reach = 0.0f;
+    anim->boxes = boxes;
+
+    // every frame is sliced into the same buffer, sized for the widest one
+    size_t max_width = 0;
+    for(size_t anchor_index = 0; anchor_index < MAX_TEXTURES_PER_ANIMATION; anchor_index++)
+    {
+        if (anchors[anchor_index] != 0) max_width = MAX(max_width, (size_t)sprite->widths[anchor_index]);
+    }
+    unsigned char* frame_buffer = malloc(4*max_width*img->height);
+    unsigned char* index_buffer = sprite_set.palette >= 0 ? malloc(max_width*img->height) : NULL;
+
+    size_t frames_num = 0;
+    size_t animation_frame_idx = 0;
+    for(size_t anchor_index = 0; anchor_index < MAX_TEXTURES_PER_ANIMATION; anchor_index++)
+    {
+        if (anchors[anchor_index] == 0) continue;
+        else frames_num++;
+
+        size_t width = sprite->widths[anchor_index];
+        assert(width != 0);
+        size_t anchor = anchors[anchor_index];
+        assert(anchor != 0);
+        // from the frame's top row down to the sheet's baseline, which stands on the ground
+        Rectangle bounds = sprite->bounds[anchor_index];
+        Rectangle crop_rect = {.height = sprite->baseline - bounds.y, .width = width, .x = (float)anchor - width/2, .y = bounds.y}; 
+        trace_begin("slice_frame");
+        Image cropped_image = slice_frame(img, crop_rect, bounds, frame_buffer);
+        trace_end();
+        // ExportImage(cropped_image, "test.png"); 
+        // asm("int3");
+        assert(boxes + animation_frame_idx < MAX_FRAME_BOXES);
+        FrameBoxes* frame_boxes = &game->frame_boxes[boxes + animation_frame_idx];
+        int center = cropped_image.width/2;
+        trace_begin("compute_frame_boxes");
+        compute_frame_boxes(&cropped_image, center + sprite_set.body_right, strikes, frame_boxes);
+        trace_end();
+        // the frame reaching furthest ahead of the center is the strike, a
+        // later frame wins ties since hits land when the swing ends
+        float reach = frame_boxes->hitbox.x + frame_boxes->hitbox.width - center;
+        if (frame_boxes->hitbox.width > 0 && reach >= strike_reach)
+        {
+            strike_reach = reach;
+            anim->strike_frame = animation_frame_idx;
+        }
+        Image upload = cropped_image;
+        if (sprite_set.palette >= 0)
+        {
+            trace_begin("quantize_frame");
+            upload = quantize_frame(&cropped_image, game->palettes.colors[sprite_set.palette], index_buffer);
+            trace_end();
+        }
+        trace_begin("frame_texture");
+        anim->textures[animation_frame_idx] = frame_texture(game, &upload);
+        trace_end();
+        if (inversed_anim != NULL) inversed_anim->textures[animation_frame_idx] = anim->textures[animation_frame_idx];
+        animation_frame_idx++;
+    }
+    free(frame_buffer);
+    free(index_buffer);
+    assert(frames_num != 0);
+    anim->sprite_num = frames_num;
+    game->frame_box_num += frames_num;
+    if (inversed_anim != NULL)
+    {
+        inversed_anim->sprite_num = frames_num;
+        inversed_anim->boxes = anim->boxes;
+        inversed_anim->strike_frame = anim->strike_frame;
+    }
+    trace_end();
+    return 0;
+}
+
+size_t set_duration(const SpriteSet* sprites, AnimationDuration duration, size_t fallback)
+{
+    return sprites->durations[duration] != 0 ? sprites->durations[duration] : fallback;
+}
+
+size_t load_animations(Game* game, SpriteSet sprites, Traits traits)
+{
+    size_t num_of_animations = 0;
+    // without an idle pose the whole frame is body
+    sprites.body_right = BODY_UNBOUNDED;
+    
+    for(ImageKind kind = 0; kind < IMAGE_KIND_NUM; kind++)
+    {
+        Sprite* sprite = &sprites.sprites[kind];
+        if (sprite->image_path == NULL) continue;
+        sprite->image = *sheet_load(game, sprite->image_path);
+        detect_frames(sprite, sprites.figure_width);
+    }
+    trace_begin("build_palettes");
+    build_palettes(game, &sprites);
+    trace_end();
+    if (sprites.figure_height == 0)
+    {
+        Sprite* idle = &sprites.sprites[IDLE_IMAGE];
+        assert(idle->image_path != NULL);
+        sprites.figure_height = idle->baseline - idle->bounds[0].y;
+    }
+
+    int anchors[MAX_TEXTURES_PER_ANIMATION] = {0};
+    for(ImageKind kind = 0; kind < IMAGE_KIND_NUM; kind++)
+    {
+        if (sprites.sprites[kind].image_path == NULL) continue;
+        Image image = sprites.sprites[kind].image;
+        for(int i = 0;i < MAX_TEXTURES_PER_ANIMATION; i++) {anchors[i] = 0;}
+
+        switch(kind)
+        {
+            case IDLE_IMAGE:
+            {
+                // the resting pose tells the body apart from the weapon in every other frame
+                int anchor = sprites.sprites[kind].anchors[0];
+                int body_x0 = 0;
+                int body_x1 = 0;
+                if (body_columns(&image, sprites.sprites[kind].bounds[0], &body_x0, &body_x1)) sprites.body_right = body_x1 - anchor;
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                num_of_animations = sprite_to_animation(game, traits, IDLING, sprites, IDLE_IMAGE, set_duration(&sprites, DURATION_IDLE, IDLE_DURATION_FRAMES), anchors);
+                break;
+            }   
+            case ATTACK_IMAGE:
+            {
+                anchors[0] = sprites.sprites[kind].anchors[0];
+                num_of_animations = sprite_to_animation(game, traits, INPUTTING, sprites, ATTACK_IMAGE, set_duration(&sprites, DURATION_INPUT, INPUT_MODE_DURATION_FRAMES), anchors);
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                anchors[0] = 0;
+                num_of_animations = sprite_to_animation(game, traits, HITTING, sprites, ATTACK_IMAGE, set_duration(&sprites, DURATION_HIT, HIT_DURATION_FRAMES), anchors);
+                break;
+            }   
+            case WALK_IMAGE:
+            {
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                num_of_animations = sprite_to_animation(game, traits, MOVING, sprites, WALK_IMAGE, set_duration(&sprites, DURATION_WALK, WALK_ANIMATION_DURATION_FRAMES), anchors);
+                break;
+            }
+            case JUMP_IMAGE:
+            {
+#ifdef FLYING_ENABLE
+                size_t fly_anim_texture_index = 0;
+                for(int i = 5;i <= 10; i++) 
+                {
+                    anchors[fly_anim_texture_index] = sprites.sprites[kind].anchors[i];
+                    fly_anim_texture_index++;
+                }
+                for(int i = 10;i >= 5; i--) 
+                {
+                    anchors[fly_anim_texture_index] = sprites.sprites[kind].anchors[i];
+                    fly_anim_texture_index++;
+                }
+                num_of_animations = sprite_to_animation(
+                        game,
+                        traits,
+                        FLYING | IDLING | MOVING,
+                        sprites,
+                        JUMP_IMAGE,
+                        set_duration(&sprites, DURATION_FLY, FLY_ANIMATION_DURATION_FRAMES),
+                        anchors);
+                break;
+#endif //FLYING_ENABLE
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                num_of_animations = sprite_to_animation(
+                        game,
+                        traits,
+                        TAKING_OFF | IDLING | MOVING,
+                        sprites,
+                        JUMP_IMAGE,
+                        set_duration(&sprites, DURATION_FLY, FLY_ANIMATION_DURATION_FRAMES),
+                        anchors);
+                break;
+            }
+            case HURT_IMAGE:
+            {
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                num_of_animations = sprite_to_animation(game, traits, DEFENDING, sprites, HURT_IMAGE, set_duration(&sprites, DURATION_DEFEND, DEFEND_ANIMATION_DURATION_FRAMES), anchors);
+                break;
+            }
+            case DEAD_IMAGE:
+            {
+                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
+                num_of_animations = sprite_to_animation(game, traits, TAKING_DAMAGE, sprites, DEAD_IMAGE, set_duration(&sprites, DURATION_DAMAGE, TAKING_DAMAGE_ANIMATION_DURATION_FRAMES), anchors);
+                break;
+            }
+            default:
+            {
+                assert(false);
+            }
+        }
+    }   
+    return num_of_animations;
+}
+
+// the state whose animation a thing with these attributes shows, -1 if it isn't one state
+int attribute_state(Attributes attr)
+{
+    switch (attr & ~LOOKS_LEFT)
+    {
+        case IDLING: return IDLE;
+        case MOVING: return MOVE;
+        case INPUTTING: return INPUT;
+        case DEFENDING: return DEFEND;
+        case TAKING_DAMAGE: return TAKE_DAMAGE;
+        case HITTING: return HIT;
+        default: return -1;
+    }
+}
+
+thing_idx get_animation_idx_for(Game* game, ThingKind kind, Attributes attr)
+{
+#ifdef KIND_TABLES
+    // the attributes of a state index the generated tables, anything else is searched
+    KindResources* res = &game->resources.kinds[kind];
+    int state = attribute_state(attr);
+    if (res->tabled && state >= 0) return res->first_animation + TABLE_ANIMATION_SLOT[kind][state][(attr & LOOKS_LEFT) != 0];
+#endif
+    int best_index = 0;
+    int max_overlap = -1;
+
+    for (size_t i = 0; i < game->animation_num; i++) {
+        if (!(game->animations[i].kind == kind)) continue;
+        int overlap = count_bits(game->animations[i].attr & attr);
+
+        if (overlap > max_overlap) {
+            max_overlap = overlap;
+            best_index = i;
+        }
+    }
+
+    return best_index;
+}
+
+thing_idx get_animation_idx(Game* game, thing_idx idx)
+{
+    Thing* thing = &game->things[idx];
+    return get_animation_idx_for(game, thing->kind, thing->attr);
+}
+
+// attributes calc_attributes will give a thing in this state
+Attributes state_attributes(State state)
+{
+    switch (state)
     {
-        game->animation_num++;
-        assert(game->animation_num < MAX_ANIMATIONS);
-        inversed_anim = &game->animations[animation_idx + 1];
-        init_animation(inversed_anim, attr | LOOKS_LEFT, sprite_set, duration_frames);
+        case IDLE: return IDLING;
+        case MOVE: return MOVING;
+        case INPUT: return INPUTTING;
+        case DEFEND: return DEFENDING;
+        case TAKE_DAMAGE: return TAKING_DAMAGE;
+        case DEATH: return TAKING_DAMAGE; // the dead sheet
+        case HIT: return HITTING;
+        default: return IDLING;
     }
-    Image* img = &sprite->image;
+}
 
-    size_t frames_num = 0;
-    size_t animation_frame_idx = 0;
-    for(size_t anchor_index = 0; anchor_index < MAX_TEXTURES_PER_ANIMATION; anchor_index++)
+size_t state_duration_frames(Game* game, thing_idx idx, State state)
+{
+    Thing* thing = &game->things[idx];
+    Attributes attr = state_attributes(state) | (thing->attr & LOOKS_LEFT);
+    return game->animations[get_animation_idx_for(game, thing->kind, attr)].duration_frames;
+}
+
+// thing_idx get_state_duration(Game* game, thing_idx idx)
+// {
+//     Thing* thing = &game->things[idx];
+//
+//     int best_index = 0;
+//     int max_overlap = -1;
+//
+//     for (size_t i = 0; i < game->animation_num; i++) {
+//         if (!(game->animations[i].kind == thing->kind)) continue;
+//         int overlap = count_bits(game->animations[i].attr & thing->attr);
+//
+//         if (overlap > max_overlap) {
+//             max_overlap = overlap;
+//             best_index = i;
+//         }
+//     }
+//
+//     return best_index;
+// }
+
+void draw_hit_text(Game* game)
+{
+    #define RENDER_TEXT_SIZE 5
+    size_t font_size = HIT_TEXT_FONT_SIZE;
+    static char render_text[RENDER_TEXT_SIZE + 1];  
+    Thing * player = &game->things[game->player_idx];
+    size_t start = player->hit_text_idx;
+    for (size_t i = 0; i < RENDER_TEXT_SIZE; i++)
     {
-        if (anchors[anchor_index] == 0) continue;
-        else frames_num++;
+        render_text[i] = game->hit_text[(start + i)%HIT_TEXT_CAPACITY];
+    }     
+    render_text[RENDER_TEXT_SIZE] = '\0';
+    int text_len_px = MeasureText(render_text, font_size);
+    // DrawLine(0, HIT_TEXT_POSITION_Y, SCREEN_WIDTH, HIT_TEXT_POSITION_Y, BLACK);
+    // DrawText(&player->hit_text[player->hit_text_idx % HIT_TEXT_CAPACITY], 0, HIT_TEXT_POSITION_Y, SCREEN_WIDTH/10, BLACK);
+    DrawText(render_text, player->position.x - text_len_px/2, player->position.y - HIT_TEXT_POSITION_Y, font_size, BLACK);
 
-        Image cropped_image = ImageCopy(*img);
-        size_t width = sprite->widths[anchor_index];
-        // assert(width != 0);
-        if (width == 0) width = sprite_set.figure_width;
-        size_t anchor = anchors[anchor_index];
-        assert(anchor != 0);
-        Rectangle crop_rect = {.height = img->height, .width = width, .x = anchor - width/2, .y = img->height - sprite_set.figure_height}; 
-        ImageCrop(&cropped_image, crop_rect);
-        float resize_coef = (float)THING_HEIGHT_DEFAULT/cropped_image.height;   
-        // float resize_coef = 0.5;   
-        int new_width = resize_coef * (float) cropped_image.width;
-        int new_height = resize_coef * (float) cropped_image.height;
-        ImageResize(&cropped_image, new_width, new_height); 
-        // ExportImage(cropped_image, "test.png"); 
-        // asm("int3");
-        anim->textures[animation_frame_idx] = LoadTextureFromImage(cropped_image);
-        if ((traits & HAS_DIRECTION) == HAS_DIRECTION)
-        {    
-            Image inversed_image = ImageCopy(cropped_image);
-            ImageFlipHorizontal(&inversed_image);
-            inversed_anim->textures[animation_frame_idx]= LoadTextureFromImage(inversed_image);
-            UnloadImage(inversed_image);
+    // DrawLine(0, HIT_TEXT_POSITION_Y + HIT_TEXT_HEIGHT, SCREEN_WIDTH, HIT_TEXT_POSITION_Y + HIT_TEXT_HEIGHT, BLACK);
+}
+
+void draw_stage(Game* game)
+{
+    (void)game;
+    DrawLine(LINE_NUMBER_OFFSET, STAGE_COORDINATE, RENDER_WIDTH, STAGE_COORDINATE, BLACK);
+
+    // static char render_text[2];  
+    // size_t font_size = COLUMN_CELL_HEIGHT - 5;
+    // render_text[1] = '\0';
+    // for(size_t i = 0; i < game->thing_num; i++)
+    // {
+    //     Thing* thing = &game->things[i];
+    //     if(thing->kind != GRID_CELL) continue;
+    //     render_text[0] = game->hit_text[thing->hit_text_idx];
+    //     int text_len_px = MeasureText(render_text, font_size);
+    //     // DrawRectangleLines(thing->position.x - COLUMN_CELL_WIDTH/2, STAGE_COORDINATE, COLUMN_CELL_WIDTH, COLUMN_CELL_HEIGHT, RED);
+    //     DrawText(render_text, thing->position.x - text_len_px/2, SCREEN_HEIGHT - font_size , font_size, BLACK);
+    //     // RLAPI void DrawRectangle(int posX, int posY, int width, int height, Color color);
+    // }
+}
+
+void draw_grid(Game* game)
+{
+    // DrawLine(0, STAGE_COORDINATE, SCREEN_WIDTH, STAGE_COORDINATE, BLACK);
+    static char render_text[2];  
+    size_t font_size = CELL_HEIGHT * 0.4;
+    Color outline_color = BLACK;
+    outline_color.a = GRID_TRANSPARENCY;
+    render_text[1] = '\0';
+    for(thing_idx i = 1; i <= game->thing_num; i++)
+    {
+        Thing* thing = &game->things[i];
+        if(thing->kind != GRID_CELL) continue;
+        render_text[0] = game->hit_text[thing->hit_text_idx];
+        int text_len_px = MeasureText(render_text, font_size);
+        DrawRectangleLines(thing->position.x - CELL_WIDTH/2.0f, thing->position.y - CELL_HEIGHT/2.0f, CELL_WIDTH, CELL_HEIGHT, outline_color);
+        DrawText(render_text, thing->position.x - text_len_px/2.0f, thing->position.y - font_size/2.0f, font_size, outline_color);
+        // RLAPI void DrawRectangle(int posX, int posY, int width, int height, Color color);
+    }
+}
+
+size_t animation_frame_at(Game* game, thing_idx i, Animation* animation)
+{
+    Thing* thing = &game->things[i];
+    size_t state_duration = animation->duration_frames;
+    if (state_duration == 0) return 0;
+    size_t age = state_age(game, thing);
+    // sleeping things loop their idle animation without any per tick work
+    if (game->activity.asleep[i]) age %= state_duration;
+    size_t animation_frame = (size_t)(((float)age/(float)state_duration) * (float)animation->sprite_num);
+    if (animation_frame >= animation->sprite_num) animation_frame = animation->sprite_num - 1;
+    return animation_frame;
+}
+
+// frame local box to world space, the way draw_things places the texture
+Rectangle frame_box_to_world(Thing* thing, Animation* animation, size_t frame, Rectangle box)
+{
+    Texture2D* texture = &animation->textures[frame];
+    float draw_width = texture->width * animation->scale;
+    float draw_height = texture->height * animation->scale;
+    if (animation->flipped) box.x = texture->width - box.x - box.width;
+    return (Rectangle){
+        .x = thing->position.x - draw_width/2.0f + box.x*animation->scale,
+        .y = thing->position.y - draw_height + box.y*animation->scale,
+        .width = box.width*animation->scale,
+        .height = box.height*animation->scale,
+    };
+}
+
+bool draw_things(Game * game)
+{
+    // indexed frames go through the palette shader, switch only when the kind of frame changes
+    bool palette_mode = false;
+    for(thing_idx i = 0; i <= game->thing_num; i++)
+    {
+        Thing * thing = &game->things[i];
+        if(thing->kind == DEFAULT_THING_KIND) continue;
+        thing_idx animation_idx = get_animation_idx(game, i);
+        if (animation_idx == 0) continue;
+        Animation* animation = &game->animations[animation_idx];
+        if (animation->duration_frames == 0) continue;
+        size_t animation_frame = animation_frame_at(game, i, animation);
+        Texture2D* texture = &animation->textures[animation_frame];
+        if (texture->id == 0) continue;
+        game->resources.kinds[thing->kind].last_drawn = game->tick;
+        float draw_width = texture->width * animation->scale;
+        float draw_height = texture->height * animation->scale;
+        // snapped to the target's pixels so a texel never straddles two of them
+        Vector2 texture_position = {.x = floorf(thing->position.x - draw_width/2.0f), .y = floorf(thing->position.y - draw_height)};
+        Rectangle source = {.x = 0, .y = 0, .width = texture->width, .height = texture->height};
+        if (animation->flipped) source.width = -source.width;
+        Rectangle dest = {.x = texture_position.x, .y = texture_position.y, .width = draw_width, .height = draw_height};
+        bool indexed = animation->palette >= 0;
+        if (indexed && !palette_mode) begin_palette_mode(game);
+        if (!indexed && palette_mode) EndShaderMode();
+        palette_mode = indexed;
+        Color tint = indexed ? (Color){.r = animation->palette + thing->palette, .a = 255} : WHITE;
+        DrawTexturePro(*texture, source, dest, ZERO_VECTOR, 0.0f, tint);
+#ifdef DEBUG_THINGS
+        if (palette_mode) EndShaderMode();
+        palette_mode = false;
+        DrawCircle(thing->position.x , thing->position.y, 5, GREEN);
+        Rectangle hitbox = {.height = CELL_HEIGHT * thing->height, .width = CELL_WIDTH * thing->width, .x = texture_position.x, .y = texture_position.y};
+        Rectangle texture_outline = dest;
+        DrawRectangleLinesEx(hitbox, 1, RED);
+        DrawRectangleLinesEx(texture_outline, 1, BLUE);
+        if (animation->boxes != 0)
+        {
+            FrameBoxes* boxes = &game->frame_boxes[animation->boxes + animation_frame];
+            DrawRectangleLinesEx(frame_box_to_world(thing, animation, animation_frame, boxes->hurtbox), 1, MAROON);
+            if (boxes->hitbox.width > 0) DrawRectangleLinesEx(frame_box_to_world(thing, animation, animation_frame, boxes->hitbox), 1, ORANGE);
+        }
+
+        // Reach is shown as a vertical marker line at reach X on stage.
+        if ((thing->traits & CAN_HIT) == CAN_HIT)
+        {
+            float reach_len_px = CELL_WIDTH * thing->reach;
+            float dir_x = (thing->orientation.x < 0.0f) ? -1.0f : 1.0f;
+            float reach_x = thing->position.x + dir_x * reach_len_px;
+            DrawLineV((Vector2){reach_x, thing->position.y - CELL_HEIGHT},
+                      (Vector2){reach_x, thing->position.y},
+                      PURPLE);
+        }
+#endif //DEBUG_THINGS
+    }   
+    if (palette_mode) EndShaderMode();
+    return true;
+}
+
+void generate_hit_text(Game* game)
+{
+    for(size_t i = 0; i < HIT_TEXT_CAPACITY; i++) 
+    {
+       int idx = rand() % CHARSET_SIZE;
+       game->hit_text[i] = CHARSET[idx];
+    }
+}
+
+bool is_in_reach(Game* game, thing_idx attacker_idx, thing_idx candidate_idx)
+{
+    bool res = false;
+    Thing* attacker = &game->things[attacker_idx];
+    Thing* candidate = &game->things[candidate_idx];
+    // check for reach if attacker can attack 
+    if ( ((attacker->traits & CAN_HIT) == CAN_HIT) && ((attacker->traits & ENEMY) != (candidate->traits & ENEMY)) )
+    {
+        if (fabs(candidate->position.y - attacker->position.y) > candidate->height*CELL_HEIGHT/2.0) return false;
+
+        float reach_len_px = CELL_WIDTH * attacker->reach;
+        float dir_x = (attacker->orientation.x < 0.0f) ? -1.0f : 1.0f;
+        float reach_x = attacker->position.x + dir_x * reach_len_px;
+        float min_x = MIN(attacker->position.x, reach_x);
+        float max_x = MAX(attacker->position.x, reach_x);
+
+        if ((candidate->position.x >= min_x) && (candidate->position.x <= max_x)) return true;
+    }
+    return res;
+}
+
+// the mask row sampled at FRAME_MASK_DIM points across the intersection
+uint32_t sample_mask_row(uint32_t mask_row, Rectangle box, bool flipped, Rectangle inter)
+{
+    uint32_t row = 0;
+    for (int c = 0; c < FRAME_MASK_DIM; c++)
+    {
+        float x = inter.x + (c + 0.5f)*inter.width/FRAME_MASK_DIM;
+        int mx = (int)((x - box.x)*FRAME_MASK_DIM/box.width);
+        mx = MAX(0, MIN(mx, FRAME_MASK_DIM - 1));
+        // the mask was built on the unflipped frame
+        if (flipped) mx = FRAME_MASK_DIM - 1 - mx;
+        row |= ((mask_row >> mx) & 1u) << c;
+    }
+    return row;
+}
+
+int mask_row_at(Rectangle box, float y)
+{
+    int my = (int)((y - box.y)*FRAME_MASK_DIM/box.height);
+    return MAX(0, MIN(my, FRAME_MASK_DIM - 1));
+}
+
+bool masks_overlap(const uint32_t* a_mask, Rectangle a_box, bool a_flipped, const uint32_t* b_mask, Rectangle b_box, bool b_flipped)
+{
+    Rectangle inter = GetCollisionRec(a_box, b_box);
+    if (inter.width <= 0 || inter.height <= 0) return false;
+    for (int r = 0; r < FRAME_MASK_DIM; r++)
+    {
+        float y = inter.y + (r + 0.5f)*inter.height/FRAME_MASK_DIM;
+        uint32_t a_row = sample_mask_row(a_mask[mask_row_at(a_box, y)], a_box, a_flipped, inter);
+        uint32_t b_row = sample_mask_row(b_mask[mask_row_at(b_box, y)], b_box, b_flipped, inter);
+        if (a_row & b_row) return true;
+    }
+    return false;
+}
+
+// weapon of the attacker's swing against the body the candidate shows right
+// now: boxes first, masks only if the boxes touch. Things without boxes fall
+// back to the reach line
+bool hit_connects(Game* game, thing_idx attacker_idx, thing_idx candidate_idx)
+{
+    Thing* attacker = &game->things[attacker_idx];
+    Thing* candidate = &game->things[candidate_idx];
+    if ((attacker->traits & CAN_HIT) != CAN_HIT) return false;
+    if ((attacker->traits & ENEMY) == (candidate->traits & ENEMY)) return false;
+
+    Attributes facing = Vector2Equals(attacker->orientation, default_orientation) ? 0 : LOOKS_LEFT;
+    Animation* swing = &game->animations[get_animation_idx_for(game, attacker->kind, HITTING | facing)];
+    Animation* body = &game->animations[get_animation_idx(game, candidate_idx)];
+    if (swing->boxes == 0 || swing->strike_frame < 0 || body->boxes == 0) return is_in_reach(game, attacker_idx, candidate_idx);
+
+    FrameBoxes* weapon = &game->frame_boxes[swing->boxes + swing->strike_frame];
+    size_t body_frame = animation_frame_at(game, candidate_idx, body);
+    FrameBoxes* target = &game->frame_boxes[body->boxes + body_frame];
+    Rectangle hitbox = frame_box_to_world(attacker, swing, swing->strike_frame, weapon->hitbox);
+    Rectangle hurtbox = frame_box_to_world(candidate, body, body_frame, target->hurtbox);
+    if (!CheckCollisionRecs(hitbox, hurtbox)) return false;
+    return masks_overlap(weapon->hit_mask, hitbox, swing->flipped, target->hurt_mask, hurtbox, body->flipped);
+}
+
+void calc_attributes(Game* game)
+{
+    for(size_t n = 0; n < game->activity.active_num; n++)
+    {
+        thing_idx i = game->activity.active[n];
+        Thing* thing = &game->things[i];
+        if (!Vector2Equals(thing->velocity, ZERO_VECTOR)) thing->state = MOVE;
+        switch(thing->state)
+        {
+            case IDLE:{thing->attr = IDLING;break;} 
+            case MOVE:
+            {
+                if((thing->attr & IN_THE_AIR) == IN_THE_AIR)
+                {
+
+                }
+                else
+                {
+                    thing->attr = MOVING;
+                }
+                break;
+            }
+            case INPUT:{thing->attr = INPUTTING;break;}
+            case DEFEND:{thing->attr = DEFENDING;break;}
+            case TAKE_DAMAGE:{thing->attr = TAKING_DAMAGE;break;}
+            case DEATH:{thing->attr = TAKING_DAMAGE;break;}
+            case HIT:
+            {
+                thing->attr = HITTING;
+                // the hit lands on the last tick of the swing
+                if ((thing->state_expire == game->tick) && (thing->damage != 0))
+                {
+                    for(thing_idx check_for_hit_thing_idx = 1; check_for_hit_thing_idx  <= (thing_idx)game->thing_num; check_for_hit_thing_idx++)
+                    {
+                        if (i == check_for_hit_thing_idx) continue;  
+                        // despawned slots and the dying can't be hit
+                        Thing* candidate = &game->things[check_for_hit_thing_idx];
+                        if (candidate->kind == DEFAULT_THING_KIND || candidate->state == DEATH) continue;
+                        if (hit_connects(game, i, check_for_hit_thing_idx))
+                        {
+                            Thing* attacked = &game->things[check_for_hit_thing_idx]; 
+                            for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) {attacked->defend_text[char_idx] = 0;}
+                            for (int char_idx = 0; char_idx < thing->damage; char_idx++)
+                            {
+                                attacked->defend_text[char_idx] = thing->damage_text[char_idx];
+                            }
+                            state_transition(game, check_for_hit_thing_idx, DEFEND);
+                        }
+                    }
+                }
+                break;
+            }
+            default:
+            {
+                thing->attr = IDLING;
+            }
+        }
+        if (!Vector2Equals(thing->orientation, default_orientation)) 
+        {
+            thing->attr |= LOOKS_LEFT;
         }
-        animation_frame_idx++;
-    }
-    assert(frames_num != 0);
-    anim->sprite_num = frames_num;
-    if (inversed_anim != NULL) inversed_anim->sprite_num = frames_num;
-    return 0;
+        else 
+        {
+            thing->attr = clear_bit(thing->attr, LOOKS_LEFT);
+        }
+        if (thing->position.y != STAGE_COORDINATE) 
+        {
+            thing->attr |= IN_THE_AIR;
+        } 
+        else 
+        {
+            thing->attr = clear_bit(thing->attr, IN_THE_AIR);
+        }
+    }   
 }
 
-
-size_t load_animations(Game* game, SpriteSet sprites, Traits traits)
+void process_game(Game* game)
 {
-    size_t num_of_animations = 0;
-    
-    int anchors[MAX_TEXTURES_PER_ANIMATION] = {0};
-    // for(int i = 0;i < MAX_SPRITES_PER_SPRITE_SHEET; i++) {use_anchors[i] = true;}
-    for(ImageKind kind = 0; kind < IMAGE_KIND_NUM; kind++)
+    calc_attributes(game);
+    for(size_t n = 0; n < game->activity.active_num; n++)
     {
-        Sprite sprite = sprites.sprites[kind]; 
-        if (sprites.sprites[kind].image_path == NULL) continue;
-        Image image = LoadImage(sprites.sprites[kind].image_path);
-        assert(image.width != 0);
-        sprites.sprites[kind].image = image;
-        assert(sprite.frame_num != 0);
-        for(int i = 0;i < MAX_TEXTURES_PER_ANIMATION; i++) {anchors[i] = 0;}
-
-        switch(kind)
+        thing_idx i = game->activity.active[n];
+        Thing* thing = &game->things[i];
+        switch(thing->state)
         {
-            case IDLE_IMAGE:
-            {
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                num_of_animations = sprite_to_animation(game, traits, IDLING, sprites, IDLE_IMAGE, IDLE_DURATION_FRAMES, anchors);
-                break;
-            }   
-            case ATTACK_IMAGE:
+            case IDLE:{break;} 
+            case MOVE:
             {
-                anchors[0] = sprites.sprites[kind].anchors[0];
-                num_of_animations = sprite_to_animation(game, traits, INPUTTING, sprites, ATTACK_IMAGE, INPUT_MODE_DURATION_FRAMES, anchors);
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                anchors[0] = 0;
-                num_of_animations = sprite_to_animation(game, traits, HITTING, sprites, ATTACK_IMAGE, HIT_DURATION_FRAMES, anchors);
+                // Vector2 old_position = thing->position;
+                if (Vector2Equals(thing->velocity, ZERO_VECTOR) && (check_bitmask(thing->attr, MOVING)))
+                {
+                    state_expire(game, i);
+                    break;
+                }
+                float pixel_inc_x = ((thing->velocity.x * WORLD_UNIT) / 1000.0f ) * MS_PER_FRAME;
+                float pixel_inc_y = ((thing->velocity.y * WORLD_UNIT) / 1000.0f ) * MS_PER_FRAME;
+                thing->position.x += pixel_inc_x;
+                thing->position.y += pixel_inc_y;
+
+                if(thing->position.y >= STAGE_COORDINATE) thing->position.y = STAGE_COORDINATE;
                 break;
-            }   
-            case WALK_IMAGE:
+            }
+            case INPUT:
             {
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                num_of_animations = sprite_to_animation(game, traits, MOVING, sprites, WALK_IMAGE, WALK_ANIMATION_DURATION_FRAMES, anchors);
+                char key_pressed = thing->key_pressed;
+                bool player_key = key_pressed != 0 && i == game->player_idx;
+                if (player_key) latency_mark(game, LATENCY_CONSUMED);
+                // the key that opened the input state isn't typed at the text
+                if (player_key && thing->state_start != game->tick)
+                {
+                    telemetry_key(game, TELEMETRY_INPUT, game->hit_text[thing->hit_text_idx], key_pressed, thing->state_start);
+                }
+                if (key_pressed == game->hit_text[thing->hit_text_idx])
+                {
+                    thing->hit_text_idx = (thing->hit_text_idx + 1) % HIT_TEXT_CAPACITY;
+                    thing->damage_text[thing->damage] = game->key_pressed;
+                    thing->damage += 1;
+                    if (player_key) latency_mark(game, LATENCY_STATE);
+                }
                 break;
             }
-            case JUMP_IMAGE:
+            case DEFEND:
             {
-#ifdef FLYING_ENABLE
-                size_t fly_anim_texture_index = 0;
-                for(int i = 5;i <= 10; i++) 
+                if ((thing->traits & ENEMY) == ENEMY) break;
+                char key_pressed = thing->key_pressed;
+                bool player_key = key_pressed != 0 && i == game->player_idx;
+                if (player_key) latency_mark(game, LATENCY_CONSUMED);
+                size_t ch_idx = get_first_char_idx(thing->defend_text, DEFEND_TEXT_CAPACITY);
+                char defend_text_char = thing->defend_text[ch_idx];
+                if (player_key && defend_text_char != 0)
                 {
-                    anchors[fly_anim_texture_index] = sprites.sprites[kind].anchors[i];
-                    fly_anim_texture_index++;
+                    telemetry_key(game, TELEMETRY_DEFEND, defend_text_char, key_pressed, thing->state_start);
                 }
-                for(int i = 10;i >= 5; i--) 
+
+                if (defend_text_char == 0) state_transition(game, i, IDLE);
+                // a typed key either clears a char or ends the defense
+                if (player_key) latency_mark(game, LATENCY_STATE);
+                if (key_pressed == defend_text_char)
                 {
-                    anchors[fly_anim_texture_index] = sprites.sprites[kind].anchors[i];
-                    fly_anim_texture_index++;
+                   thing->defend_text[ch_idx] = 0;
+                }
+                else
+                {
+                    state_transition(game, i, TAKE_DAMAGE);
                 }
-                num_of_animations = sprite_to_animation(
-                        game,
-                        traits,
-                        FLYING | IDLING | MOVING,
-                        sprites,
-                        JUMP_IMAGE,
-                        FLY_ANIMATION_DURATION_FRAMES,
-                        anchors);
-                break;
-#endif //FLYING_ENABLE
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                num_of_animations = sprite_to_animation(
-                        game,
-                        traits,
-                        TAKING_OFF | IDLING | MOVING,
-                        sprites,
-                        JUMP_IMAGE,
-                        FLY_ANIMATION_DURATION_FRAMES,
-                        anchors);
                 break;
             }
-            case HURT_IMAGE:
+            case TAKE_DAMAGE:
             {
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                num_of_animations = sprite_to_animation(game, traits, DEFENDING, sprites, HURT_IMAGE, DEFEND_ANIMATION_DURATION_FRAMES, anchors);
                 break;
             }
-            case DEAD_IMAGE:
+            case HIT:
             {
-                for(size_t i = 0;i < sprites.sprites[kind].frame_num; i++) {anchors[i] = sprites.sprites[kind].anchors[i];}
-                num_of_animations = sprite_to_animation(game, traits, TAKING_DAMAGE, sprites, DEAD_IMAGE, TAKING_DAMAGE_ANIMATION_DURATION_FRAMES, anchors);
                 break;
             }
             default:
             {
-                assert(false);
             }
         }
-        UnloadImage(image);
     }   
-    return num_of_animations;
+}   
+size_t get_first_char_idx(char* arr, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (arr[i] != 0) return i;
+    }
+    return 0;
+}
+
+float apply_x_velocity_decay(float vx)
+{
+    float decay_step = VELOCITY_DECAY_PER_SECOND * (MS_PER_FRAME / 1000.0f);
+    if (vx > 0.0f)
+    {
+        vx -= decay_step;
+        if (vx < 0.0f) vx = 0.0f;
+    }
+    else if (vx < 0.0f)
+    {
+        vx += decay_step;
+        if (vx > 0.0f) vx = 0.0f;
+    }
+
+    return vx;
+}
+
+void thing_die(Game* game, thing_idx idx);
+void despawn_thing(Game* game, thing_idx idx);
+
+void state_expired(Game* game, thing_idx i)
+{
+    Thing* thing = &game->things[i];
+    switch(thing->state)
+    {
+        case INPUT:
+        {
+            if (thing->damage != 0) state_transition(game, i, HIT);
+            else
+            {
+                state_transition(game, i, IDLE);
+                thing->damage = 0;
+            }
+            break;
+        }
+        case HIT:
+        {
+            state_transition(game, i, IDLE);
+            thing->damage = 0;
+            break;
+        }
+        case MOVE:
+        {
+            if (!Vector2Equals(thing->velocity, ZERO_VECTOR)) state_transition(game, i, MOVE);
+            else state_transition(game, i, IDLE);
+            break;
+        }
+        case DEFEND:
+        {
+            size_t damage_to_take = get_damage_to_take(thing);
+            if (damage_to_take != 0) 
+            {
+                thing->health -= damage_to_take;
+                // the player can't die until there is a game over
+                if (thing->health > 0 || (thing->traits & NPC) != NPC) state_transition(game, i, TAKE_DAMAGE);
+                else thing_die(game, i);
+            }
+            else
+            {
+                state_transition(game, i, IDLE);
+            }
+            for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) {thing->defend_text[char_idx] = 0;}
+            break;
+        }
+        case DEATH:
+        {
+            despawn_thing(game, i);
+            break;
+        }
+        default:
+        {
+            state_transition(game, i, IDLE);
+            break;
+        } 
+    }
+}
+
+void increment_game(Game* game)
+{
+    for(size_t n = 0; n < game->activity.active_num; n++)
+    {
+        Thing* thing = &game->things[game->activity.active[n]];
+        if( ( thing->traits & CAN_MOVE) == CAN_MOVE)
+        {
+            float dt_sec = MS_PER_FRAME / 1000.0f;
+
+            thing->velocity.x = apply_x_velocity_decay(thing->velocity.x);
+            if (thing->position.y < STAGE_COORDINATE)
+            {
+                thing->velocity.y += GRAVITY_UNITS_PER_SECOND_SQ * dt_sec;
+                if (thing->velocity.y > MAX_FALL_SPEED_UNITS_PER_SECOND)
+                {
+                    thing->velocity.y = MAX_FALL_SPEED_UNITS_PER_SECOND;
+                }
+            }
+            else if (thing->velocity.y > 0.0f)
+            {
+                thing->velocity.y = 0.0f;
+            }
+        }
+    }
+    // only the things whose state ends this tick are visited
+    thing_idx i = timer_advance(game);
+    while (i != 0)
+    {
+        thing_idx next = game->timers.next[i];
+        game->timers.next[i] = 0;
+        game->timers.prev[i] = 0;
+        state_expired(game, i);
+        i = next;
+    }
+    activity_update(game);
+    telemetry_tick(game);
+    game->tick++;
+}
+
+const char* kind_name(const Game* game, ThingKind kind)
+{
+    return game->resources.names[kind];
+}
+
+// the id of a named kind, new names get the next free one. The built in
+// kinds are registered first so their ids match the enum
+ThingKind kind_register(Game* game, const char* name)
+{
+    Resources* resources = &game->resources;
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++)
+    {
+        if (strcmp(resources->names[kind], name) == 0) return kind;
+    }
+    assert(resources->kind_num < MAX_KINDS);
+    assert(strlen(name) < KIND_NAME_CAPACITY);
+    ThingKind kind = resources->kind_num++;
+    strcpy(resources->names[kind], name);
+    return kind;
+}
+
+// -1 if no kind has the name
+int kind_find(const Game* game, const char* name)
+{
+    for (ThingKind kind = 0; kind < game->resources.kind_num; kind++)
+    {
+        if (strcmp(game->resources.names[kind], name) == 0) return kind;
+    }
+    return -1;
+}
+
+// reach and body size come from the animations of the kind
+void kind_measure(Game* game, ThingKind kind, float* reach, float* height, float* width)
+{
+    {
+        // calculate reach from attack animation size
+        thing_idx anim_idx = get_animation_idx_for(game, kind, HITTING);
+        Animation* anim = &game->animations[anim_idx];
+        int max_attack_width = 0;
+        for (size_t frame = 0; frame < anim->sprite_num; frame++)
+        {
+            Texture2D* attack_texture = &anim->textures[frame];
+            if (attack_texture->id == 0) continue;
+            if ((int)attack_texture->width > max_attack_width) max_attack_width = attack_texture->width;
+        }
+        if (max_attack_width == 0) max_attack_width = anim->textures[0].width;
+        *reach = (float)max_attack_width * anim->scale / (float)CELL_WIDTH / 2.0f;
+    }
+    {
+        // calculate hitbox from idle animation size
+        thing_idx anim_idx = get_animation_idx_for(game, kind, IDLING);
+        Animation* anim = &game->animations[anim_idx];
+        *height = (float)(anim->textures[0].height) * anim->scale / (float)(CELL_HEIGHT);
+        *width = (float)(anim->textures[0].width) * anim->scale / (float)(CELL_WIDTH);
+    }
+}
+
+#ifdef KIND_TABLES
+// tables generated from other sheets or another manifest point at the wrong rows
+bool kind_tables_match(Game* game, ThingKind kind)
+{
+    KindResources* res = &game->resources.kinds[kind];
+    if (kind >= TABLE_KIND_NUM || strcmp(TABLE_KIND_NAMES[kind], kind_name(game, kind)) != 0) return false;
+    if (res->animation_num != TABLE_ANIMATION_NUM[kind]) return false;
+    for (size_t i = 0; i < res->animation_num; i++)
+    {
+        Animation* anim = &game->animations[res->first_animation + i];
+        if ((uint32_t)anim->attr != TABLE_ANIMATION_ATTR[kind][i] ||
+            anim->sprite_num != TABLE_FRAME_NUM[kind][i] ||
+            anim->duration_frames != TABLE_DURATION_FRAMES[kind][i]) return false;
+    }
+    float reach = 0, height = 0, width = 0;
+    kind_measure(game, kind, &reach, &height, &width);
+    return reach == TABLE_REACH[kind] && height == TABLE_HEIGHT[kind] && width == TABLE_WIDTH[kind];
+}
+#endif //KIND_TABLES
+
+void resource_define(Game* game, SpriteSet set, Traits traits)
+{
+    KindResources* res = &game->resources.kinds[set.kind];
+    assert(!res->defined);
+    set.palette = -1;
+    res->set = set;
+    res->traits = traits;
+    res->defined = true;
+}
+
+void resource_unload(Game* game, ThingKind kind)
+{
+    KindResources* res = &game->resources.kinds[kind];
+    assert(res->loaded && res->refs == 0);
+    for (size_t i = res->first_animation; i < res->first_animation + res->animation_num; i++)
+    {
+        Animation* anim = &game->animations[i];
+        // the flipped animation borrows the textures of the one before it
+        for (size_t frame = 0; frame < anim->sprite_num; frame++)
+        {
+            if (!anim->flipped) frame_texture_release(game, anim->textures[frame]);
+            anim->textures[frame] = (Texture2D){0};
+        }
+    }
+    // close up the rows and boxes so a kind loaded later can have them,
+    // everything after them moves down over the gap
+    size_t animation_end = res->first_animation + res->animation_num;
+    size_t box_end = res->first_box + res->box_num;
+    memmove(&game->animations[res->first_animation], &game->animations[animation_end], (game->animation_num - animation_end)*sizeof(Animation));
+    memmove(&game->frame_boxes[res->first_box], &game->frame_boxes[box_end], (game->frame_box_num - box_end)*sizeof(FrameBoxes));
+    game->animation_num -= res->animation_num;
+    game->frame_box_num -= res->box_num;
+    for (size_t i = res->first_animation; i < game->animation_num; i++)
+    {
+        Animation* anim = &game->animations[i];
+        if (anim->boxes >= box_end) anim->boxes -= res->box_num;
+    }
+    for (ThingKind other = 0; other < game->resources.kind_num; other++)
+    {
+        KindResources* other_res = &game->resources.kinds[other];
+        if (!other_res->loaded || other == kind) continue;
+        if (other_res->first_animation >= animation_end) other_res->first_animation -= res->animation_num;
+        if (other_res->first_box >= box_end) other_res->first_box -= res->box_num;
+    }
+    res->animation_num = 0;
+    res->box_num = 0;
+    res->loaded = false;
+    TraceLog(LOG_INFO, "RESOURCES: evicted %s, %zu KB of textures live", kind_name(game, kind), game->assets.texture_bytes/1024);
+}
+
+// evict the least recently drawn kinds nothing uses until the textures fit the budget
+void resources_trim(Game* game)
+{
+    Resources* resources = &game->resources;
+    while (resources->budget_bytes != 0 && game->assets.texture_bytes > resources->budget_bytes)
+    {
+        ThingKind victim = DEFAULT_THING_KIND;
+        for (ThingKind kind = 0; kind < game->resources.kind_num; kind++)
+        {
+            KindResources* res = &resources->kinds[kind];
+            if (!res->loaded || res->refs > 0) continue;
+            if (victim == DEFAULT_THING_KIND || res->last_drawn < resources->kinds[victim].last_drawn) victim = kind;
+        }
+        if (victim == DEFAULT_THING_KIND)
+        {
+            TraceLog(LOG_WARNING, "RESOURCES: %zu KB of textures in use, over the %zu KB budget", game->assets.texture_bytes/1024, resources->budget_bytes/1024);
+            return;
+        }
+        resource_unload(game, victim);
+    }
+}
+
+void resource_load(Game* game, ThingKind kind)
+{
+    trace_begin("resource_load");
+    KindResources* res = &game->resources.kinds[kind];
+    assert(res->defined && !res->loaded);
+    res->tabled = false;
+    res->first_animation = game->animation_num;
+    res->first_box = game->frame_box_num;
+    load_animations(game, res->set, res->traits);
+    sheet_cache_release(game);
+    trace_begin("palette_upload");
+    palette_upload(game);
+    trace_end();
+    res->animation_num = game->animation_num - res->first_animation;
+    res->box_num = game->frame_box_num - res->first_box;
+    // reloads quantize into the palettes the first load built
+    res->set.palette = game->animations[res->first_animation].palette;
+    res->texture_bytes = 0;
+    for (size_t i = res->first_animation; i < res->first_animation + res->animation_num; i++)
+    {
+        Animation* anim = &game->animations[i];
+        if (anim->flipped) continue;
+        for (size_t frame = 0; frame < anim->sprite_num; frame++)
+        {
+            Texture2D* texture = &anim->textures[frame];
+            res->texture_bytes += GetPixelDataSize(texture->width, texture->height, texture->format);
+        }
+    }
+    res->loaded = true;
+    res->loads++;
+    res->last_drawn = game->tick;
+#ifdef KIND_TABLES
+    res->tabled = kind_tables_match(game, kind);
+    if (!res->tabled) TraceLog(LOG_WARNING, "TABLES: %s differs from the generated tables, rerun ./nob", kind_name(game, kind));
+#endif
+    TraceLog(LOG_INFO, "RESOURCES: loaded %s, %zu KB, %zu KB of textures live", kind_name(game, kind), res->texture_bytes/1024, game->assets.texture_bytes/1024);
+    trace_end();
+}
+
+// a thing of the kind spawned
+void resource_acquire(Game* game, ThingKind kind)
+{
+    KindResources* res = &game->resources.kinds[kind];
+    if (!res->loaded) resource_load(game, kind);
+    res->refs++;
+    res->last_drawn = game->tick;
+    resources_trim(game);
+}
+
+// a thing of the kind is gone, its textures stay until the budget needs the room
+void resource_release(Game* game, ThingKind kind)
+{
+    KindResources* res = &game->resources.kinds[kind];
+    assert(res->refs > 0);
+    res->refs--;
+    resources_trim(game);
 }
 
-thing_idx get_animation_idx(Game* game, thing_idx idx)
+void resources_configure(Game* game, size_t budget_kb)
+{
+    game->resources.budget_bytes = budget_kb*1024;
+    resources_trim(game);
+}
+
+void resources_unload_all(Game* game)
+{
+    for (ThingKind kind = 0; kind < game->resources.kind_num; kind++)
+    {
+        KindResources* res = &game->resources.kinds[kind];
+        res->refs = 0;
+        if (res->loaded) resource_unload(game, kind);
+    }
+    if (game->palettes.texture.id != 0)
+    {
+        texture_unload(game->palettes.texture);
+        shader_unload(game->palettes.shader);
+    }
+    texture_unload(game->animations[0].textures[0]);
+}
+
+void thing_measure(Game* game, thing_idx idx)
 {
     Thing* thing = &game->things[idx];
+    thing->attr = IDLING;
+#ifdef KIND_TABLES
+    if (game->resources.kinds[thing->kind].tabled)
+    {
+        thing->reach = TABLE_REACH[thing->kind];
+        thing->height = TABLE_HEIGHT[thing->kind];
+        thing->width = TABLE_WIDTH[thing->kind];
+        return;
+    }
+#endif
+    kind_measure(game, thing->kind, &thing->reach, &thing->height, &thing->width);
+}
 
-    int best_index = 0;
-    int max_overlap = -1;
+// loads the kind if needed, measures the thing and arms its first state expiry
+void spawn_thing(Game* game, thing_idx idx)
+{
+    resource_acquire(game, game->things[idx].kind);
+    thing_measure(game, idx);
+    state_transition(game, idx, IDLE);
+}
 
-    for (size_t i = 0; i < game->animation_num; i++) {
-        if (!(game->animations[i].kind == thing->kind)) continue;
-        int overlap = count_bits(game->animations[i].attr & thing->attr);
+// swap in freshly loaded animations of a kind, its things keep their state
+void resource_reload(Game* game, ThingKind kind)
+{
+    KindResources* res = &game->resources.kinds[kind];
+    size_t refs = res->refs;
+    res->refs = 0;
+    if (res->loaded) resource_unload(game, kind);
+    resource_load(game, kind);
+    res->refs = refs;
+    for (thing_idx i = 1; i <= game->thing_num; i++)
+    {
+        Thing* thing = &game->things[i];
+        if (thing->kind != kind) continue;
+        Attributes attr = thing->attr;
+        thing_measure(game, i);
+        thing->attr = attr;
+    }
+    resources_trim(game);
+}
 
-        if (overlap > max_overlap) {
-            max_overlap = overlap;
-            best_index = i;
+#ifdef __linux__
+typedef struct
+{
+    char paths[HOT_RELOAD_MAX_SHEETS][SHEET_PATH_CAPACITY];
+    Image images[HOT_RELOAD_MAX_SHEETS];
+    size_t num;
+    ThingKind kind;
+    bool ready;
+} StagedSheets;
+
+// watches the manifest and the directories of every defined sprite set. A
+// worker thread parses an edited manifest and decodes the sheets of a
+// changed set, the main thread swaps them in between two frames, uploads
+// stay on the main thread
+typedef struct
+{
+    int fd;
+    int watches[HOT_RELOAD_MAX_WATCHES];
+    char dirs[HOT_RELOAD_MAX_WATCHES][SHEET_PATH_CAPACITY];
+    size_t watch_num;
+    Manifest watched;          // worker only, the sets point into it
+    SpriteSet sets[MAX_KINDS]; // worker only
+    bool defined[MAX_KINDS];
+    char names[MAX_KINDS][KIND_NAME_CAPACITY];
+    size_t kind_num;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool running;
+    bool quit;                                   // guarded by lock
+    StagedSheets staged[HOT_RELOAD_MAX_PENDING]; // guarded by lock
+    Manifest edited;                             // guarded by lock
+    bool manifest_ready;                         // guarded by lock
+} HotReload;
+
+const char* manifest_string(const Manifest* manifest, uint32_t offset);
+SpriteSet manifest_kind_set(const Manifest* manifest, const ManifestKind* entry, ThingKind kind);
+bool manifest_parse_file(Manifest* manifest, const char* path);
+void manifest_apply(Game* game, const Manifest* edited);
+
+// every sheet path a set reads, variants included
+size_t hot_reload_paths(const SpriteSet* set, char paths[][SHEET_PATH_CAPACITY], size_t capacity)
+{
+    size_t num = 0;
+    for (ImageKind kind = 0; kind < IMAGE_KIND_NUM; kind++)
+    {
+        const char* path = set->sprites[kind].image_path;
+        if (path == NULL) continue;
+        assert(num < capacity);
+        snprintf(paths[num++], SHEET_PATH_CAPACITY, "%s", path);
+        const char* file = strrchr(path, '/');
+        for (size_t v = 0; v < MAX_PALETTE_VARIANTS && set->variants[v] != NULL; v++)
+        {
+            assert(num < capacity);
+            snprintf(paths[num++], SHEET_PATH_CAPACITY, "%s/%s", set->variants[v], file ? file + 1 : path);
         }
     }
-
-    return best_index;
+    return num;
 }
 
-// thing_idx get_state_duration(Game* game, thing_idx idx)
-// {
-//     Thing* thing = &game->things[idx];
-//
-//     int best_index = 0;
-//     int max_overlap = -1;
-//
-//     for (size_t i = 0; i < game->animation_num; i++) {
-//         if (!(game->animations[i].kind == thing->kind)) continue;
-//         int overlap = count_bits(game->animations[i].attr & thing->attr);
-//
-//         if (overlap > max_overlap) {
-//             max_overlap = overlap;
-//             best_index = i;
-//         }
-//     }
-//
-//     return best_index;
-// }
+// path is dir/name
+bool path_is(const char* path, const char* dir, const char* name)
+{
+    size_t dir_len = strlen(dir);
+    return strncmp(path, dir, dir_len) == 0 && path[dir_len] == '/' && strcmp(path + dir_len + 1, name) == 0;
+}
 
-void draw_hit_text(Game* game)
+void hot_reload_watch(HotReload* hot, const char* path)
 {
-    #define RENDER_TEXT_SIZE 5
-    size_t font_size = 16*1.5;
-    static char render_text[RENDER_TEXT_SIZE + 1];  
-    Thing * player = &game->things[game->player_idx];
-    size_t start = player->hit_text_idx;
-    for (size_t i = 0; i < RENDER_TEXT_SIZE; i++)
+    char dir[SHEET_PATH_CAPACITY];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) strcpy(dir, ".");
+    else *slash = '\0';
+    for (size_t i = 0; i < hot->watch_num; i++) if (strcmp(hot->dirs[i], dir) == 0) return;
+    assert(hot->watch_num < HOT_RELOAD_MAX_WATCHES);
+    int wd = inotify_add_watch(hot->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
     {
-        render_text[i] = game->hit_text[(start + i)%HIT_TEXT_CAPACITY];
-    }     
-    render_text[RENDER_TEXT_SIZE] = '\0';
-    int text_len_px = MeasureText(render_text, font_size);
-    // DrawLine(0, HIT_TEXT_POSITION_Y, SCREEN_WIDTH, HIT_TEXT_POSITION_Y, BLACK);
-    // DrawText(&player->hit_text[player->hit_text_idx % HIT_TEXT_CAPACITY], 0, HIT_TEXT_POSITION_Y, SCREEN_WIDTH/10, BLACK);
-    DrawText(render_text, player->position.x - text_len_px/2, player->position.y - HIT_TEXT_POSITION_Y, font_size, BLACK);
-
-    // DrawLine(0, HIT_TEXT_POSITION_Y + HIT_TEXT_HEIGHT, SCREEN_WIDTH, HIT_TEXT_POSITION_Y + HIT_TEXT_HEIGHT, BLACK);
+        TraceLog(LOG_WARNING, "HOTRELOAD: can't watch %s: %s", dir, strerror(errno));
+        return;
+    }
+    hot->watches[hot->watch_num] = wd;
+    strcpy(hot->dirs[hot->watch_num], dir);
+    hot->watch_num++;
 }
 
-void draw_stage(Game* game)
+// the sets of the watched manifest and the directories of their sheets.
+// Kinds it adds get the ids kind_register gives them on the main thread
+void hot_reload_track(HotReload* hot)
 {
-    (void)game;
-    DrawLine(LINE_NUMBER_OFFSET, STAGE_COORDINATE, SCREEN_WIDTH, STAGE_COORDINATE, BLACK);
+    for (size_t i = 0; i < hot->watched.kind_num; i++)
+    {
+        const ManifestKind* entry = &hot->watched.kinds[i];
+        const char* name = manifest_string(&hot->watched, entry->name);
+        ThingKind kind = 0;
+        while (kind < hot->kind_num && strcmp(hot->names[kind], name) != 0) kind++;
+        if (kind == hot->kind_num)
+        {
+            assert(hot->kind_num < MAX_KINDS);
+            snprintf(hot->names[hot->kind_num++], KIND_NAME_CAPACITY, "%s", name);
+        }
+        hot->sets[kind] = manifest_kind_set(&hot->watched, entry, kind);
+        hot->defined[kind] = true;
+        char paths[HOT_RELOAD_MAX_SHEETS][SHEET_PATH_CAPACITY];
+        size_t num = hot_reload_paths(&hot->sets[kind], paths, HOT_RELOAD_MAX_SHEETS);
+        for (size_t p = 0; p < num; p++) hot_reload_watch(hot, paths[p]);
+    }
+}
 
-    // static char render_text[2];  
-    // size_t font_size = COLUMN_CELL_HEIGHT - 5;
-    // render_text[1] = '\0';
-    // for(size_t i = 0; i < game->thing_num; i++)
-    // {
-    //     Thing* thing = &game->things[i];
-    //     if(thing->kind != GRID_CELL) continue;
-    //     render_text[0] = game->hit_text[thing->hit_text_idx];
-    //     int text_len_px = MeasureText(render_text, font_size);
-    //     // DrawRectangleLines(thing->position.x - COLUMN_CELL_WIDTH/2, STAGE_COORDINATE, COLUMN_CELL_WIDTH, COLUMN_CELL_HEIGHT, RED);
-    //     DrawText(render_text, thing->position.x - text_len_px/2, SCREEN_HEIGHT - font_size , font_size, BLACK);
-    //     // RLAPI void DrawRectangle(int posX, int posY, int width, int height, Color color);
-    // }
+// a manifest that doesn't parse keeps the old one, the parser says why
+void hot_reload_manifest(HotReload* hot)
+{
+    static Manifest parsed;
+    trace_begin("hot_reload_manifest");
+    bool valid = manifest_parse_file(&parsed, MANIFEST_PATH);
+    trace_end();
+    if (!valid) return;
+    pthread_mutex_lock(&hot->lock);
+    hot->edited = parsed;
+    hot->manifest_ready = true;
+    pthread_mutex_unlock(&hot->lock);
+    hot->watched = parsed;
+    hot_reload_track(hot);
+    TraceLog(LOG_INFO, "HOTRELOAD: parsed %zu kinds of %s", parsed.kind_num, MANIFEST_PATH);
 }
 
-void draw_grid(Game* game)
+// false if every pending slot is taken, the kind stays dirty
+bool hot_reload_decode(HotReload* hot, ThingKind kind)
 {
-    // DrawLine(0, STAGE_COORDINATE, SCREEN_WIDTH, STAGE_COORDINATE, BLACK);
-    static char render_text[2];  
-    size_t font_size = CELL_HEIGHT * 0.4;
-    Color outline_color = BLACK;
-    outline_color.a = GRID_TRANSPARENCY;
-    render_text[1] = '\0';
-    for(thing_idx i = 1; i <= game->thing_num; i++)
+    // a newer edit supersedes one the game hasn't picked up yet
+    pthread_mutex_lock(&hot->lock);
+    StagedSheets* slot = NULL;
+    for (size_t i = 0; i < HOT_RELOAD_MAX_PENDING; i++)
     {
-        Thing* thing = &game->things[i];
-        if(thing->kind != GRID_CELL) continue;
-        render_text[0] = game->hit_text[thing->hit_text_idx];
-        int text_len_px = MeasureText(render_text, font_size);
-        DrawRectangleLines(thing->position.x - CELL_WIDTH/2.0f, thing->position.y - CELL_HEIGHT/2.0f, CELL_WIDTH, CELL_HEIGHT, outline_color);
-        DrawText(render_text, thing->position.x - text_len_px/2.0f, thing->position.y - font_size/2.0f, font_size, outline_color);
-        // RLAPI void DrawRectangle(int posX, int posY, int width, int height, Color color);
+        StagedSheets* staged = &hot->staged[i];
+        if (staged->ready && staged->kind == kind) slot = staged;
+        if (!staged->ready && slot == NULL) slot = staged;
+    }
+    pthread_mutex_unlock(&hot->lock);
+    if (slot == NULL) return false;
+
+    StagedSheets staged = {0};
+    trace_begin("hot_reload_decode");
+    staged.num = hot_reload_paths(&hot->sets[kind], staged.paths, HOT_RELOAD_MAX_SHEETS);
+    for (size_t i = 0; i < staged.num; i++)
+    {
+        trace_begin("LoadImage");
+        staged.images[i] = LoadImage(staged.paths[i]);
+        ImageFormat(&staged.images[i], PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        trace_end();
     }
+    trace_end();
+    staged.kind = kind;
+    staged.ready = true;
+    pthread_mutex_lock(&hot->lock);
+    // the main thread may have taken the slot meanwhile, only the worker fills them
+    if (slot->ready && slot->kind == kind) for (size_t i = 0; i < slot->num; i++) UnloadImage(slot->images[i]);
+    *slot = staged;
+    pthread_mutex_unlock(&hot->lock);
+    TraceLog(LOG_INFO, "HOTRELOAD: decoded %zu sheets of %s", staged.num, hot->names[kind]);
+    return true;
 }
 
-bool draw_things(Game * game)
+void* hot_reload_worker(void* arg)
 {
-    for(thing_idx i = 0; i <= game->thing_num; i++)
+    HotReload* hot = arg;
+    trace_thread("hot reload");
+    uint64_t dirty_since[MAX_KINDS] = {0}; // 0 is clean
+    uint64_t manifest_dirty_since = 0;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
     {
-        Thing * thing = &game->things[i];
-        if(thing->kind == DEFAULT_THING_KIND) continue;
-        thing_idx animation_idx = get_animation_idx(game, i);
-        if (animation_idx == 0) continue;
-        Animation* animation = &game->animations[animation_idx];
-        int state_duration = animation->duration_frames;
-        if (state_duration == 0) continue;
-        size_t animation_frame = (size_t)(((float)thing->state_cnt/(float)state_duration) * (float)animation->sprite_num);
-        if (animation_frame >= animation->sprite_num) animation_frame = animation->sprite_num - 1;
-        Texture2D* texture = &animation->textures[animation_frame];
-        if (texture->id == 0) continue;
-        Vector2 texture_position = {.x = thing->position.x - texture->width/2.0 ,.y = thing->position.y - texture->height};
-        DrawTextureV(*texture, texture_position, WHITE);
-#ifdef DEBUG_THINGS
-        DrawCircle(thing->position.x , thing->position.y, 5, GREEN);
-        Rectangle hitbox = {.height = CELL_HEIGHT * thing->height, .width = CELL_WIDTH * thing->width, .x = texture_position.x, .y = texture_position.y};
-        Rectangle texture_outline = {.height = texture->height, .width = texture->width, .x = texture_position.x, .y = texture_position.y};
-        DrawRectangleLinesEx(hitbox, 1, RED);
-        DrawRectangleLinesEx(texture_outline, 1, BLUE);
+        pthread_mutex_lock(&hot->lock);
+        bool quit = hot->quit;
+        pthread_mutex_unlock(&hot->lock);
+        if (quit) break;
 
-        // Reach is shown as a vertical marker line at reach X on stage.
-        if ((thing->traits & CAN_HIT) == CAN_HIT)
+        struct pollfd pfd = {.fd = hot->fd, .events = POLLIN};
+        if (poll(&pfd, 1, 50) > 0)
         {
-            float reach_len_px = CELL_WIDTH * thing->reach;
-            float dir_x = (thing->orientation.x < 0.0f) ? -1.0f : 1.0f;
-            float reach_x = thing->position.x + dir_x * reach_len_px;
-            DrawLineV((Vector2){reach_x, thing->position.y - CELL_HEIGHT},
-                      (Vector2){reach_x, thing->position.y},
-                      PURPLE);
+            ssize_t len = read(hot->fd, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < len;)
+            {
+                struct inotify_event* event = (struct inotify_event*)(buffer + offset);
+                offset += sizeof(struct inotify_event) + event->len;
+                if (event->len == 0) continue;
+                const char* dir = NULL;
+                for (size_t i = 0; i < hot->watch_num; i++) if (hot->watches[i] == event->wd) dir = hot->dirs[i];
+                if (dir == NULL) continue;
+                if (path_is(MANIFEST_PATH, dir, event->name)) manifest_dirty_since = now_ns();
+                for (ThingKind kind = 0; kind < hot->kind_num; kind++)
+                {
+                    if (!hot->defined[kind]) continue;
+                    char paths[HOT_RELOAD_MAX_SHEETS][SHEET_PATH_CAPACITY];
+                    size_t num = hot_reload_paths(&hot->sets[kind], paths, HOT_RELOAD_MAX_SHEETS);
+                    for (size_t i = 0; i < num; i++) if (path_is(paths[i], dir, event->name)) dirty_since[kind] = now_ns();
+                }
+            }
         }
-#endif //DEBUG_THINGS
-    }   
-    return true;
+        uint64_t now = now_ns();
+        // the manifest first, the sheets are decoded with the paths it names
+        if (manifest_dirty_since != 0 && now - manifest_dirty_since >= HOT_RELOAD_DEBOUNCE_NS)
+        {
+            manifest_dirty_since = 0;
+            hot_reload_manifest(hot);
+        }
+        for (ThingKind kind = 0; kind < hot->kind_num; kind++)
+        {
+            if (dirty_since[kind] == 0 || now - dirty_since[kind] < HOT_RELOAD_DEBOUNCE_NS) continue;
+            if (hot_reload_decode(hot, kind)) dirty_since[kind] = 0;
+        }
+    }
+    return NULL;
 }
 
-void generate_hit_text(Game* game)
+bool hot_reload_start(HotReload* hot, Game* game)
 {
-    for(size_t i = 0; i < HIT_TEXT_CAPACITY; i++) 
+    memset(hot, 0, sizeof(*hot));
+    hot->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hot->fd < 0)
     {
-       int idx = rand() % CHARSET_SIZE;
-       game->hit_text[i] = CHARSET[idx];
+        TraceLog(LOG_WARNING, "HOTRELOAD: inotify unavailable: %s", strerror(errno));
+        return false;
+    }
+    hot->kind_num = game->resources.kind_num;
+    memcpy(hot->names, game->resources.names, sizeof(hot->names));
+    // the sets of the game point into its manifest, the worker gets its own
+    hot->watched = game->manifest;
+    hot_reload_track(hot);
+    hot_reload_watch(hot, MANIFEST_PATH);
+    pthread_mutex_init(&hot->lock, NULL);
+    if (pthread_create(&hot->thread, NULL, hot_reload_worker, hot) != 0)
+    {
+        close(hot->fd);
+        return false;
     }
+    hot->running = true;
+    TraceLog(LOG_INFO, "HOTRELOAD: watching %zu directories", hot->watch_num);
+    return true;
 }
 
-bool is_in_reach(Game* game, thing_idx attacker_idx, thing_idx candidate_idx)
+// at a frame boundary, swap in every kind the worker has decoded
+void hot_reload_apply(HotReload* hot, Game* game)
 {
-    bool res = false;
-    Thing* attacker = &game->things[attacker_idx];
-    Thing* candidate = &game->things[candidate_idx];
-    // check for reach if attacker can attack 
-    if ( ((attacker->traits & CAN_HIT) == CAN_HIT) && ((attacker->traits & ENEMY) != (candidate->traits & ENEMY)) )
+    if (!hot->running) return;
     {
-        if (fabs(candidate->position.y - attacker->position.y) > candidate->height*CELL_HEIGHT/2.0) return false;
+        static Manifest edited;
+        pthread_mutex_lock(&hot->lock);
+        bool ready = hot->manifest_ready;
+        if (ready)
+        {
+            edited = hot->edited;
+            hot->manifest_ready = false;
+        }
+        pthread_mutex_unlock(&hot->lock);
+        if (ready) manifest_apply(game, &edited);
+    }
+    for (size_t slot = 0; slot < HOT_RELOAD_MAX_PENDING; slot++)
+    {
+        // most frames nothing is ready, the sheets are only copied out when they are
+        StagedSheets staged;
+        pthread_mutex_lock(&hot->lock);
+        bool ready = hot->staged[slot].ready;
+        if (ready)
+        {
+            staged = hot->staged[slot];
+            hot->staged[slot].ready = false;
+        }
+        pthread_mutex_unlock(&hot->lock);
+        if (!ready) continue;
+        ThingKind kind = staged.kind;
 
-        float reach_len_px = CELL_WIDTH * attacker->reach;
-        float dir_x = (attacker->orientation.x < 0.0f) ? -1.0f : 1.0f;
-        float reach_x = attacker->position.x + dir_x * reach_len_px;
-        float min_x = MIN(attacker->position.x, reach_x);
-        float max_x = MAX(attacker->position.x, reach_x);
+        bool decoded = true;
+        for (size_t i = 0; i < staged.num; i++) decoded = decoded && staged.images[i].data != NULL;
+        // unused kinds only need their stale textures dropped
+        KindResources* res = &game->resources.kinds[kind];
+        bool reload = decoded && res->refs > 0;
+        for (size_t i = 0; i < staged.num; i++)
+        {
+            if (reload) sheet_cache_put(game, staged.paths[i], staged.images[i]);
+            else UnloadImage(staged.images[i]);
+        }
+        if (reload) resource_reload(game, kind);
+        else if (!decoded) TraceLog(LOG_WARNING, "HOTRELOAD: %s has sheets that don't decode, keeping the old ones", kind_name(game, kind));
+        else if (res->loaded) resource_unload(game, kind);
+    }
+}
 
-        if ((candidate->position.x >= min_x) && (candidate->position.x <= max_x)) return true;
+void hot_reload_stop(HotReload* hot)
+{
+    if (!hot->running) return;
+    pthread_mutex_lock(&hot->lock);
+    hot->quit = true;
+    pthread_mutex_unlock(&hot->lock);
+    pthread_join(hot->thread, NULL);
+    for (size_t slot = 0; slot < HOT_RELOAD_MAX_PENDING; slot++)
+    {
+        StagedSheets* staged = &hot->staged[slot];
+        if (staged->ready) for (size_t i = 0; i < staged->num; i++) UnloadImage(staged->images[i]);
     }
-    return res;
+    pthread_mutex_destroy(&hot->lock);
+    close(hot->fd);
+    hot->running = false;
 }
+#endif //__linux__
 
-void calc_attributes(Game* game)
+// sprite manifest. Kinds, their sheets and timings are authored as text and
+// compiled to a binary image of the Manifest, both are read in one pass
+// into the fixed tables without allocating
+//
+// kind <name> <trait>...      starts a kind, traits are names or the player and enemy presets
+// sheet <image> <path>        image is idle, attack, walk, jump, hurt or dead
+// frames <image> <count>
+// anchors <image> <x>...      frame centers in the sheet
+// widths <image> <width>...
+// variant <dir>               directory with a recolor of every sheet
+// figure <width> <height>     0 measures it from the sheets
+// duration <animation> <ms>   idle, input, hit, walk, fly, defend or damage
+typedef struct
+{
+    const char* data;
+    size_t len;
+} Token;
+
+bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+Token next_token(const char** cursor, const char* end)
+{
+    const char* c = *cursor;
+    while (c < end && is_blank(*c)) c++;
+    const char* start = c;
+    while (c < end && !is_blank(*c)) c++;
+    *cursor = c;
+    return (Token){.data = start, .len = c - start};
+}
+
+// paths may hold spaces, they run to the end of the line
+Token rest_of_line(const char** cursor, const char* end)
+{
+    const char* c = *cursor;
+    while (c < end && is_blank(*c)) c++;
+    const char* last = end;
+    while (last > c && is_blank(last[-1])) last--;
+    *cursor = end;
+    return (Token){.data = c, .len = last - c};
+}
+
+bool token_is(Token token, const char* word)
+{
+    return token.len == strlen(word) && memcmp(token.data, word, token.len) == 0;
+}
+
+// -1 if the token names none of them
+int token_lookup(Token token, const char** names, int num)
+{
+    for (int i = 0; i < num; i++) if (names[i] != NULL && token_is(token, names[i])) return i;
+    return -1;
+}
+
+bool token_int(Token token, int32_t* value)
 {
-    for(thing_idx i = 1; i <= (thing_idx)game->thing_num; i++)
+    if (token.len == 0 || token.len > 9) return false;
+    int32_t result = 0;
+    for (size_t i = 0; i < token.len; i++)
     {
-        Thing* thing = &game->things[i];
-        if (!Vector2Equals(thing->velocity, ZERO_VECTOR)) thing->state = MOVE;
-        switch(thing->state)
-        {
-            case IDLE:{thing->attr = IDLING;break;} 
-            case MOVE:
-            {
-                if((thing->attr & IN_THE_AIR) == IN_THE_AIR)
-                {
+        if (token.data[i] < '0' || token.data[i] > '9') return false;
+        result = result*10 + (token.data[i] - '0');
+    }
+    *value = result;
+    return true;
+}
 
-                }
-                else
-                {
-                    thing->attr = MOVING;
-                }
-                break;
-            }
-            case INPUT:{thing->attr = INPUTTING;break;}
-            case DEFEND:{thing->attr = DEFENDING;break;}
-            case TAKE_DAMAGE:{thing->attr = TAKING_DAMAGE;break;}
-            case HIT:
-            {
-                thing->attr = HITTING;
-                int anim_idx = get_animation_idx(game, i);
-                Animation* anim  = &game->animations[anim_idx];
-                size_t current_state_dur = anim->duration_frames; 
-                if ((current_state_dur == thing->state_cnt) && (thing->damage != 0))
-                {
-                    for(thing_idx check_for_hit_thing_idx = 1; check_for_hit_thing_idx  <= (thing_idx)game->thing_num; check_for_hit_thing_idx++)
-                    {
-                        if (i == check_for_hit_thing_idx) continue;  
-                        if (is_in_reach(game, i, check_for_hit_thing_idx))
-                        {
-                            Thing* attacked = &game->things[check_for_hit_thing_idx]; 
-                            for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) {attacked->defend_text[char_idx] = 0;}
-                            for (int char_idx = 0; char_idx < thing->damage; char_idx++)
-                            {
-                                attacked->defend_text[char_idx] = thing->damage_text[char_idx];
-                            }
-                            state_transition(game, check_for_hit_thing_idx, DEFEND);
-                        }
-                    }
-                }
-                break;
+// 0 if the pool is full
+uint32_t manifest_intern(Manifest* manifest, Token token)
+{
+    if (manifest->string_len + token.len + 1 > MANIFEST_STRINGS_CAPACITY) return 0;
+    uint32_t offset = manifest->string_len;
+    memcpy(&manifest->strings[offset], token.data, token.len);
+    manifest->strings[offset + token.len] = '\0';
+    manifest->string_len += token.len + 1;
+    return offset;
+}
+
+const char* manifest_string(const Manifest* manifest, uint32_t offset)
+{
+    return offset == 0 ? NULL : &manifest->strings[offset];
+}
+
+// the frame count a list of anchors or widths sets must agree with the rest
+const char* manifest_frames(ManifestKind* kind, int image, int32_t* values, const char** cursor, const char* end)
+{
+    int32_t num = 0;
+    for (Token token = next_token(cursor, end); token.len > 0; token = next_token(cursor, end))
+    {
+        if (num == MAX_SPRITES_PER_SPRITE_SHEET) return "too many frames";
+        if (!token_int(token, &values[num++])) return "expected a number";
+    }
+    if (num == 0) return "expected a number";
+    if (kind->frame_num[image] != 0 && kind->frame_num[image] != num) return "frame count doesn't match";
+    kind->frame_num[image] = num;
+    return NULL;
+}
+
+bool manifest_parse(Manifest* manifest, const char* path, const char* text, size_t len)
+{
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->string_len = 1;
+    ManifestKind* kind = NULL;
+    const char* end = text + len;
+    size_t line = 0;
+    for (const char* start = text; start < end;)
+    {
+        const char* line_end = memchr(start, '\n', end - start);
+        if (line_end == NULL) line_end = end;
+        const char* cursor = start;
+        start = line_end < end ? line_end + 1 : end;
+        line++;
+
+        const char* error = NULL;
+        Token key = next_token(&cursor, line_end);
+        if (key.len == 0 || key.data[0] == '#') continue;
+        if (token_is(key, "kind"))
+        {
+            Token name = next_token(&cursor, line_end);
+            if (name.len == 0 || name.len >= KIND_NAME_CAPACITY) error = "kind needs a short name";
+            else if (manifest->kind_num == MAX_KINDS) error = "too many kinds";
+            for (size_t i = 0; error == NULL && i < manifest->kind_num; i++)
+            {
+                if (token_is(name, manifest_string(manifest, manifest->kinds[i].name))) error = "kind defined twice";
             }
-            default:
+            if (error == NULL)
             {
-                thing->attr = IDLING;
+                kind = &manifest->kinds[manifest->kind_num++];
+                kind->name = manifest_intern(manifest, name);
+                for (Token trait = next_token(&cursor, line_end); trait.len > 0 && error == NULL; trait = next_token(&cursor, line_end))
+                {
+                    int bit = token_lookup(trait, TRAIT_NAMES, sizeof(TRAIT_NAMES)/sizeof(TRAIT_NAMES[0]));
+                    if (token_is(trait, "player")) kind->traits |= PLAYER_TRAITS;
+                    else if (token_is(trait, "enemy")) kind->traits |= ENEMY_TRAITS_DEFAULT;
+                    else if (bit >= 0) kind->traits |= 1u << bit;
+                    else error = "unknown trait";
+                }
+                if (kind->name == 0) error = "string pool full";
             }
         }
-        if (!Vector2Equals(thing->orientation, default_orientation)) 
+        else if (kind == NULL) error = "expected a kind first";
+        else if (token_is(key, "sheet"))
         {
-            thing->attr |= LOOKS_LEFT;
+            int image = token_lookup(next_token(&cursor, line_end), IMAGE_KIND_NAMES, IMAGE_KIND_NUM);
+            Token sheet = rest_of_line(&cursor, line_end);
+            if (image <= DEFAULT_IMAGE) error = "unknown image";
+            else if (sheet.len == 0 || sheet.len >= SHEET_PATH_CAPACITY) error = "sheet needs a path";
+            else if ((kind->sheets[image] = manifest_intern(manifest, sheet)) == 0) error = "string pool full";
         }
-        else 
+        else if (token_is(key, "frames"))
         {
-            thing->attr = clear_bit(thing->attr, LOOKS_LEFT);
+            int image = token_lookup(next_token(&cursor, line_end), IMAGE_KIND_NAMES, IMAGE_KIND_NUM);
+            int32_t num = 0;
+            if (image <= DEFAULT_IMAGE) error = "unknown image";
+            else if (!token_int(next_token(&cursor, line_end), &num) || num == 0 || num > MAX_SPRITES_PER_SPRITE_SHEET) error = "bad frame count";
+            else if (kind->frame_num[image] != 0 && kind->frame_num[image] != num) error = "frame count doesn't match";
+            else kind->frame_num[image] = num;
         }
-        if (thing->position.y != STAGE_COORDINATE) 
+        else if (token_is(key, "anchors") || token_is(key, "widths"))
         {
-            thing->attr |= IN_THE_AIR;
-        } 
-        else 
+            int image = token_lookup(next_token(&cursor, line_end), IMAGE_KIND_NAMES, IMAGE_KIND_NUM);
+            if (image <= DEFAULT_IMAGE) error = "unknown image";
+            else error = manifest_frames(kind, image, token_is(key, "anchors") ? kind->anchors[image] : kind->widths[image], &cursor, line_end);
+        }
+        else if (token_is(key, "variant"))
         {
-            thing->attr = clear_bit(thing->attr, IN_THE_AIR);
+            size_t v = 0;
+            while (v < MAX_PALETTE_VARIANTS && kind->variants[v] != 0) v++;
+            Token dir = rest_of_line(&cursor, line_end);
+            if (v == MAX_PALETTE_VARIANTS) error = "too many variants";
+            else if (dir.len == 0 || dir.len >= SHEET_PATH_CAPACITY) error = "variant needs a directory";
+            else if ((kind->variants[v] = manifest_intern(manifest, dir)) == 0) error = "string pool full";
         }
-    }   
+        else if (token_is(key, "figure"))
+        {
+            if (!token_int(next_token(&cursor, line_end), &kind->figure_width) ||
+                !token_int(next_token(&cursor, line_end), &kind->figure_height)) error = "figure needs a width and a height";
+        }
+        else if (token_is(key, "duration"))
+        {
+            int duration = token_lookup(next_token(&cursor, line_end), DURATION_NAMES, DURATION_NUM);
+            if (duration < 0) error = "unknown animation";
+            else if (!token_int(next_token(&cursor, line_end), &kind->durations_ms[duration])) error = "duration needs milliseconds";
+        }
+        else error = "unknown key";
+
+        if (error == NULL && next_token(&cursor, line_end).len != 0) error = "unexpected words at the end of the line";
+        if (error != NULL)
+        {
+            TraceLog(LOG_ERROR, "MANIFEST: %s:%zu: %s", path, line, error);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < manifest->kind_num; i++)
+    {
+        if (manifest->kinds[i].sheets[IDLE_IMAGE] != 0) continue;
+        TraceLog(LOG_ERROR, "MANIFEST: %s: kind %s has no idle sheet", path, manifest_string(manifest, manifest->kinds[i].name));
+        return false;
+    }
+    return true;
 }
 
-void process_game(Game* game)
+bool manifest_write(const Manifest* manifest, const char* path)
 {
-    calc_attributes(game);
-    for(thing_idx i = 1; i <= (thing_idx)game->thing_num; i++)
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
     {
-        Thing* thing = &game->things[i];
-        int anim_idx = get_animation_idx(game, i);
-        Animation* anim  = &game->animations[anim_idx];
-        switch(thing->state)
-        {
-            case IDLE:{break;} 
-            case MOVE:
-            {
-                // Vector2 old_position = thing->position;
-                if (Vector2Equals(thing->velocity, ZERO_VECTOR) && (check_bitmask(thing->attr, MOVING)))
-                {
-                    thing->state_cnt = anim->duration_frames;
-                    break;
-                }
-                float pixel_inc_x = ((thing->velocity.x * WORLD_UNIT) / 1000.0f ) * MS_PER_FRAME;
-                float pixel_inc_y = ((thing->velocity.y * WORLD_UNIT) / 1000.0f ) * MS_PER_FRAME;
-                thing->position.x += pixel_inc_x;
-                thing->position.y += pixel_inc_y;
+        TraceLog(LOG_ERROR, "MANIFEST: can't write %s: %s", path, strerror(errno));
+        return false;
+    }
+    ManifestHeader header = {
+        .magic = MANIFEST_MAGIC,
+        .version = MANIFEST_VERSION,
+        .kind_num = manifest->kind_num,
+        .string_len = manifest->string_len,
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(manifest->kinds, sizeof(ManifestKind), manifest->kind_num, file) == manifest->kind_num &&
+                   fwrite(manifest->strings, 1, manifest->string_len, file) == manifest->string_len;
+    written = fclose(file) == 0 && written;
+    if (!written) TraceLog(LOG_ERROR, "MANIFEST: can't write %s", path);
+    return written;
+}
 
-                if(thing->position.y >= STAGE_COORDINATE) thing->position.y = STAGE_COORDINATE;
-                break;
-            }
-            case INPUT:
-            {
-                char key_pressed = thing->key_pressed;
-                if (key_pressed == game->hit_text[thing->hit_text_idx])
-                {
-                    thing->hit_text_idx = (thing->hit_text_idx + 1) % HIT_TEXT_CAPACITY;
-                    thing->damage_text[thing->damage] = game->key_pressed;
-                    thing->damage += 1;
-                }
-                break;
-            }
-            case DEFEND:
-            {
-                if ((thing->traits & ENEMY) == ENEMY) break;
-                char key_pressed = thing->key_pressed;
-                size_t ch_idx = get_first_char_idx(thing->defend_text, DEFEND_TEXT_CAPACITY);
-                char defend_text_char = thing->defend_text[ch_idx];
+// a string offset has to point at the start of a string in the pool
+bool manifest_offset_valid(const Manifest* manifest, uint32_t offset)
+{
+    return offset == 0 || (offset < manifest->string_len && manifest->strings[offset - 1] == '\0');
+}
 
-                if (defend_text_char == 0) state_transition(game, i, IDLE);
-                if (key_pressed == defend_text_char)
-                {
-                   thing->defend_text[ch_idx] = 0;
-                }
-                else
-                {
-                    state_transition(game, i, TAKE_DAMAGE);
-                }
-                break;
-            }
-            case TAKE_DAMAGE:
-            {
-                break;
-            }
-            case HIT:
-            {
-                break;
-            }
-            default:
-            {
-            }
-        }
-    }   
-}   
-size_t get_first_char_idx(char* arr, size_t len)
+bool manifest_read(Manifest* manifest, const char* path)
 {
-    for (size_t i = 0; i < len; i++)
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    ManifestHeader header = {0};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 header.magic == MANIFEST_MAGIC && header.version == MANIFEST_VERSION &&
+                 header.kind_num <= MAX_KINDS &&
+                 header.string_len >= 1 && header.string_len <= MANIFEST_STRINGS_CAPACITY;
+    if (valid)
     {
-        if (arr[i] != 0) return i;
+        manifest->kind_num = header.kind_num;
+        manifest->string_len = header.string_len;
+        valid = fread(manifest->kinds, sizeof(ManifestKind), manifest->kind_num, file) == manifest->kind_num &&
+                fread(manifest->strings, 1, manifest->string_len, file) == manifest->string_len &&
+                manifest->strings[0] == '\0' && manifest->strings[manifest->string_len - 1] == '\0';
     }
-    return 0;
+    fclose(file);
+    for (size_t i = 0; valid && i < manifest->kind_num; i++)
+    {
+        const ManifestKind* kind = &manifest->kinds[i];
+        valid = kind->name != 0 && manifest_offset_valid(manifest, kind->name) &&
+                strlen(manifest_string(manifest, kind->name)) < KIND_NAME_CAPACITY &&
+                kind->sheets[IDLE_IMAGE] != 0;
+        for (ImageKind image = 0; valid && image < IMAGE_KIND_NUM; image++)
+        {
+            valid = manifest_offset_valid(manifest, kind->sheets[image]) &&
+                    kind->frame_num[image] >= 0 && kind->frame_num[image] <= MAX_SPRITES_PER_SPRITE_SHEET;
+        }
+        for (size_t v = 0; valid && v < MAX_PALETTE_VARIANTS; v++) valid = manifest_offset_valid(manifest, kind->variants[v]);
+    }
+    if (!valid) TraceLog(LOG_WARNING, "MANIFEST: %s is not a manifest of this version", path);
+    return valid;
 }
 
-float apply_x_velocity_decay(float vx)
+bool manifest_parse_file(Manifest* manifest, const char* path)
 {
-    float decay_step = VELOCITY_DECAY_PER_SECOND * (MS_PER_FRAME / 1000.0f);
-    if (vx > 0.0f)
+    static char text[MANIFEST_TEXT_CAPACITY];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
     {
-        vx -= decay_step;
-        if (vx < 0.0f) vx = 0.0f;
+        TraceLog(LOG_ERROR, "MANIFEST: can't read %s: %s", path, strerror(errno));
+        return false;
     }
-    else if (vx < 0.0f)
+    size_t len = fread(text, 1, sizeof(text), file);
+    fclose(file);
+    if (len == sizeof(text))
     {
-        vx += decay_step;
-        if (vx > 0.0f) vx = 0.0f;
+        TraceLog(LOG_ERROR, "MANIFEST: %s is over %d KB", path, MANIFEST_TEXT_CAPACITY/1024);
+        return false;
     }
+    return manifest_parse(manifest, path, text, len);
+}
 
-    return vx;
+time_t file_mtime(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
 }
 
-void increment_game(Game* game)
+// the compiled manifest unless the text was edited after it
+bool manifest_load(Manifest* manifest, const char* text_path, const char* bin_path)
 {
-    for(thing_idx i = 1; i <= game->thing_num; i++)
+    time_t bin_time = file_mtime(bin_path);
+    if (bin_time != 0 && bin_time >= file_mtime(text_path) && manifest_read(manifest, bin_path))
     {
-        Thing* thing = &game->things[i];
-        size_t state_cnt = thing->state_cnt++;
-        int anim_idx = get_animation_idx(game, i);
-        Animation* anim  = &game->animations[anim_idx];
-        size_t current_state_dur = anim->duration_frames;
-        if( ( thing->traits & CAN_MOVE) == CAN_MOVE)
-        {
-            float dt_sec = MS_PER_FRAME / 1000.0f;
+        TraceLog(LOG_INFO, "MANIFEST: %zu kinds from %s", manifest->kind_num, bin_path);
+        return true;
+    }
+    if (!manifest_parse_file(manifest, text_path)) return false;
+    TraceLog(LOG_INFO, "MANIFEST: %zu kinds from %s", manifest->kind_num, text_path);
+    return true;
+}
 
-            thing->velocity.x = apply_x_velocity_decay(thing->velocity.x);
-            if (thing->position.y < STAGE_COORDINATE)
-            {
-                thing->velocity.y += GRAVITY_UNITS_PER_SECOND_SQ * dt_sec;
-                if (thing->velocity.y > MAX_FALL_SPEED_UNITS_PER_SECOND)
-                {
-                    thing->velocity.y = MAX_FALL_SPEED_UNITS_PER_SECOND;
-                }
-            }
-            else if (thing->velocity.y > 0.0f)
-            {
-                thing->velocity.y = 0.0f;
-            }
+// the sprite set of a manifest entry, its paths point into the manifest
+SpriteSet manifest_kind_set(const Manifest* manifest, const ManifestKind* entry, ThingKind kind)
+{
+    SpriteSet set = {0};
+    set.kind = kind;
+    for (ImageKind image = 0; image < IMAGE_KIND_NUM; image++)
+    {
+        Sprite* sprite = &set.sprites[image];
+        sprite->image_path = manifest_string(manifest, entry->sheets[image]);
+        sprite->frame_num = entry->frame_num[image];
+        for (size_t frame = 0; frame < MAX_SPRITES_PER_SPRITE_SHEET; frame++)
+        {
+            sprite->anchors[frame] = entry->anchors[image][frame];
+            sprite->widths[frame] = entry->widths[image][frame];
         }
-        if (current_state_dur <= state_cnt) 
+    }
+    for (size_t v = 0; v < MAX_PALETTE_VARIANTS; v++) set.variants[v] = manifest_string(manifest, entry->variants[v]);
+    set.figure_width = entry->figure_width;
+    set.figure_height = entry->figure_height;
+    for (AnimationDuration duration = 0; duration < DURATION_NUM; duration++)
+    {
+        int32_t ms = entry->durations_ms[duration];
+        if (ms > 0) set.durations[duration] = MAX((size_t)1, (size_t)(ms / MS_PER_FRAME));
+    }
+    return set;
+}
+
+// every kind of the manifest gets an id and a sprite set, the paths point
+// into the manifest so it has to outlive the sets
+void manifest_define(Game* game, const Manifest* manifest)
+{
+    for (size_t i = 0; i < manifest->kind_num; i++)
+    {
+        const ManifestKind* entry = &manifest->kinds[i];
+        ThingKind kind = kind_register(game, manifest_string(manifest, entry->name));
+        resource_define(game, manifest_kind_set(manifest, entry, kind), entry->traits);
+    }
+}
+
+// NULL if the manifest has no kind of the name
+const ManifestKind* manifest_find(const Manifest* manifest, const char* name)
+{
+    for (size_t i = 0; i < manifest->kind_num; i++)
+    {
+        if (strcmp(manifest_string(manifest, manifest->kinds[i].name), name) == 0) return &manifest->kinds[i];
+    }
+    return NULL;
+}
+
+bool manifest_strings_equal(const Manifest* a, uint32_t a_offset, const Manifest* b, uint32_t b_offset)
+{
+    const char* a_string = manifest_string(a, a_offset);
+    const char* b_string = manifest_string(b, b_offset);
+    if (a_string == NULL || b_string == NULL) return a_string == b_string;
+    return strcmp(a_string, b_string) == 0;
+}
+
+// the string offsets of two manifests differ, what they point at is compared
+bool manifest_kinds_equal(const Manifest* a, const ManifestKind* a_kind, const Manifest* b, const ManifestKind* b_kind)
+{
+    if (a_kind->traits != b_kind->traits ||
+        a_kind->figure_width != b_kind->figure_width ||
+        a_kind->figure_height != b_kind->figure_height ||
+        memcmp(a_kind->frame_num, b_kind->frame_num, sizeof(a_kind->frame_num)) != 0 ||
+        memcmp(a_kind->anchors, b_kind->anchors, sizeof(a_kind->anchors)) != 0 ||
+        memcmp(a_kind->widths, b_kind->widths, sizeof(a_kind->widths)) != 0 ||
+        memcmp(a_kind->durations_ms, b_kind->durations_ms, sizeof(a_kind->durations_ms)) != 0) return false;
+    for (ImageKind image = 0; image < IMAGE_KIND_NUM; image++)
+    {
+        if (!manifest_strings_equal(a, a_kind->sheets[image], b, b_kind->sheets[image])) return false;
+    }
+    for (size_t v = 0; v < MAX_PALETTE_VARIANTS; v++)
+    {
+        if (!manifest_strings_equal(a, a_kind->variants[v], b, b_kind->variants[v])) return false;
+    }
+    return true;
+}
+
+// swap in an edited manifest. Every set follows its strings to the new
+// copy, only the kinds whose entries changed are reloaded. Kinds the edit
+// dropped stay defined as they were
+void manifest_apply(Game* game, const Manifest* edited)
+{
+    bool changed[MAX_KINDS] = {0};
+    for (size_t i = 0; i < edited->kind_num; i++)
+    {
+        const ManifestKind* entry = &edited->kinds[i];
+        int kind = kind_find(game, manifest_string(edited, entry->name));
+        const ManifestKind* old = manifest_find(&game->manifest, manifest_string(edited, entry->name));
+        if (kind >= 0 && old != NULL) changed[kind] = !manifest_kinds_equal(&game->manifest, old, edited, entry);
+    }
+    game->manifest = *edited;
+    const Manifest* manifest = &game->manifest;
+    for (size_t i = 0; i < manifest->kind_num; i++)
+    {
+        const ManifestKind* entry = &manifest->kinds[i];
+        ThingKind kind = kind_register(game, manifest_string(manifest, entry->name));
+        SpriteSet set = manifest_kind_set(manifest, entry, kind);
+        KindResources* res = &game->resources.kinds[kind];
+        if (!res->defined)
         {
-            switch(thing->state)
-            {
-                case INPUT:
-                {
-                    if (thing->damage != 0) state_transition(game, i, HIT);
-                    else
-                    {
-                        state_transition(game, i, IDLE);
-                        thing->damage = 0;
-                    }
-                    break;
-                }
-                case HIT:
-                {
-                    state_transition(game, i, IDLE);
-                    thing->damage = 0;
-                    break;
-                }
-                case MOVE:
-                {
-                    if (!Vector2Equals(thing->velocity, ZERO_VECTOR)) state_transition(game, i, MOVE);
-                    else state_transition(game, i, IDLE);
-                    break;
-                }
-                case DEFEND:
-                {
-                    size_t damage_to_take = get_damage_to_take(thing);
-                    if (damage_to_take != 0) 
-                    {
-                        thing->health -= damage_to_take;
-                        if (thing->health > 0) state_transition(game, i, TAKE_DAMAGE);
-                        // else state_transition(game, i, DEATH);
-                        else state_transition(game, i, TAKE_DAMAGE);
-                    }
-                    else
-                    {
-                        state_transition(game, i, IDLE);
-                    }
-                    for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) {thing->defend_text[char_idx] = 0;}
-                    break;
-                }
-                default:
-                {
-                    state_transition(game, i, IDLE);
-                    break;
-                } 
-            }
+            resource_define(game, set, entry->traits);
+            TraceLog(LOG_INFO, "MANIFEST: defined %s", kind_name(game, kind));
+            continue;
         }
+        // the palette rows stay as long as there are as many recolors to fill
+        size_t old_variants = 0;
+        size_t new_variants = 0;
+        while (old_variants < MAX_PALETTE_VARIANTS && res->set.variants[old_variants] != NULL) old_variants++;
+        while (new_variants < MAX_PALETTE_VARIANTS && set.variants[new_variants] != NULL) new_variants++;
+        set.palette = (old_variants == new_variants) ? res->set.palette : -1;
+        res->set = set;
+        res->traits = entry->traits;
+        if (!changed[kind]) continue;
+        TraceLog(LOG_INFO, "MANIFEST: %s changed", kind_name(game, kind));
+        if (res->refs > 0) resource_reload(game, kind);
+        else if (res->loaded) resource_unload(game, kind);
     }
 }
-       
+
 void init_player(Game* game, thing_idx idx)
 {
     assert(idx == game->thing_num + 1);
-    Vector2 player_position = { SCREEN_WIDTH/2.0, STAGE_COORDINATE };
+    Vector2 player_position = { RENDER_WIDTH/2.0, STAGE_COORDINATE };
     game->things[idx].position = player_position;
     game->things[idx].orientation.x = 1;
     game->things[idx].orientation.y = 0;
@@ -919,167 +4486,298 @@ void init_player(Game* game, thing_idx idx)
     game->things[idx].kind = YAMABUSHI;
     // game->things[idx].kind = KNIGHT;
     game->thing_num++;
+    activity_add(game, idx);
+    spawn_thing(game, idx);
+}
+
+// spread the npcs over the think interval so their expensive decisions
+// don't all land on the same frame
+void ai_stagger(Game* game)
+{
+    AiScheduler* ai = &game->ai;
+    for (size_t slot = 0; slot < ai->npc_num; slot++)
+    {
+        game->things[ai->npcs[slot]].ai_next_think = game->tick + slot % ai->think_interval;
+    }
+}
+
+void ai_configure(Game* game, size_t think_interval, uint64_t budget_us)
+{
+    game->ai.think_interval = MAX(think_interval, 1);
+    game->ai.budget_ns = budget_us*1000;
+    ai_stagger(game);
+}
+
+// spawned npcs start awake
+void ai_register(Game* game, thing_idx idx)
+{
+    AiScheduler* ai = &game->ai;
+    if (ai->think_interval == 0) ai->think_interval = AI_THINK_INTERVAL_FRAMES;
+    size_t slot = ai->npc_num;
+    ai_list_add(ai, ai->npcs, &ai->npc_num, idx);
+    game->things[idx].ai_next_think = game->tick + slot % ai->think_interval;
+}
+
+void ai_unregister(Game* game, thing_idx idx)
+{
+    AiScheduler* ai = &game->ai;
+    if (ai->slot_of[idx] == 0) return;
+    if (game->activity.asleep[idx]) ai_list_remove(ai, ai->dormant, &ai->dormant_num, idx);
+    else ai_list_remove(ai, ai->npcs, &ai->npc_num, idx);
+}
+
+// a dying npc stops thinking and plays its death before despawn_thing
+void thing_die(Game* game, thing_idx idx)
+{
+    Thing* thing = &game->things[idx];
+    ai_unregister(game, idx);
+    thing->ai_move = false;
+    thing->velocity = ZERO_VECTOR;
+    state_transition(game, idx, DEATH);
+}
+
+// a despawned slot if there is one, so thing_num only grows with the
+// things alive at the same time
+thing_idx thing_alloc(Game* game)
+{
+    if (game->free_thing_num > 0) return game->free_things[--game->free_thing_num];
+    assert(game->thing_num + 1 < MAX_THINGS);
+    return ++game->thing_num;
+}
+
+// the slot is zeroed until it is reused, a DEFAULT_THING_KIND thing is
+// neither drawn nor hit
+void despawn_thing(Game* game, thing_idx idx)
+{
+    Thing* thing = &game->things[idx];
+    timer_unlink(&game->timers, idx);
+    typing_cancel(&game->typing, idx);
+    activity_remove(game, idx);
+    ThingKind kind = thing->kind;
+    memset(thing, 0, sizeof(*thing));
+    if (idx == game->thing_num) game->thing_num--;
+    else game->free_things[game->free_thing_num++] = idx;
+    resource_release(game, kind);
 }
 
 void init_orc(Game* game)
 {
-    Vector2 position = {3.0 * SCREEN_WIDTH/4, STAGE_COORDINATE};
-    thing_idx idx = ++game->thing_num;
+    Vector2 position = {3.0 * RENDER_WIDTH/4, STAGE_COORDINATE};
+    thing_idx idx = thing_alloc(game);
     game->things[idx].position = position;
     game->things[idx].orientation.x = 1;
     game->things[idx].orientation.y = 0;
     game->things[idx].traits = ENEMY_TRAITS_DEFAULT;
     game->things[idx].kind = ORC;
 
+    game->things[idx].health = NPC_HEALTH;
     game->things[idx].accuracy = 50;
+    game->things[idx].cpm = GOOD_CPM*0.6f;
+    game->things[idx].cpm_jitter = NPC_DEFAULT_CPM_JITTER;
+    ai_register(game, idx);
+    activity_add(game, idx);
+    spawn_thing(game, idx);
 } 
 
 
-void init_knight_enemy(Game* game)
+void init_enemy(Game* game, ThingKind kind, int palette)
+{
+    Vector2 position = {RENDER_WIDTH/4.0, STAGE_COORDINATE};
+    thing_idx idx = thing_alloc(game);
+    game->things[idx].position = position;
+    game->things[idx].orientation.x = 1;
+    game->things[idx].orientation.y = 0;
+    game->things[idx].traits = ENEMY_TRAITS_DEFAULT;
+    game->things[idx].kind = kind;
+    game->things[idx].palette = palette;
+    game->things[idx].health = NPC_HEALTH;
+    ai_register(game, idx);
+    activity_add(game, idx);
+    spawn_thing(game, idx);
+}
+
+// palettes a spawn of the kind can pick, the base colors included
+int kind_palette_num(Game* game, ThingKind kind)
+{
+    SpriteSet* set = &game->resources.kinds[kind].set;
+    int num = 1;
+    while (num <= MAX_PALETTE_VARIANTS && set->variants[num - 1] != NULL) num++;
+    return num;
+}
+
+// <kind> or <kind>:<variant>, variant 0 is the base colors
+void init_enemy_named(Game* game, const char* spec)
+{
+    char name[KIND_NAME_CAPACITY];
+    const char* colon = strchr(spec, ':');
+    int len = colon ? (int)(colon - spec) : (int)strlen(spec);
+    snprintf(name, sizeof(name), "%.*s", len, spec);
+    int kind = kind_find(game, name);
+    if (kind < 0 || !game->resources.kinds[kind].defined)
+    {
+        TraceLog(LOG_WARNING, "MANIFEST: no kind named %s", name);
+        return;
+    }
+    int palette = colon ? atoi(colon + 1) : 0;
+    if (palette < 0 || palette >= kind_palette_num(game, kind))
+    {
+        TraceLog(LOG_WARNING, "MANIFEST: %s has no variant %d, using the base colors", name, palette);
+        palette = 0;
+    }
+    init_enemy(game, kind, palette);
+}
+
+void init_game(Game* game)
+{
+    trace_begin("init_game");
+    memset(game, 0, sizeof(*game));
+    //default texture is useless curently
+    Image default_texture_image = GenImageColor(CELL_WIDTH, CELL_HEIGHT, PURPLE);
+    game->animations[0].textures[0] = texture_from_image(default_texture_image);
+    assert( game->animations[0].textures[0].width == CELL_WIDTH);
+    game->animations[0].sprite_num = 1;
+    game->animations[0].scale = 1.0f;
+    game->animations[0].strike_frame = -1;
+    game->animations[0].palette = -1;
+    // entry 0 means "no boxes"
+    game->frame_box_num = 1;
+    game->animation_num++;
+
+    generate_hit_text(game);
+    game->resources.budget_bytes = TEXTURE_BUDGET_KB*1024;
+
+    // frames, anchors, widths and figure heights come from the sheets, the
+    // textures of a kind are loaded when its first thing spawns
+    for (ThingKind kind = 0; kind < THING_KIND_NUM; kind++) kind_register(game, THING_KIND_NAMES[kind]);
+    trace_begin("manifest_load");
+    bool manifest_loaded = manifest_load(&game->manifest, MANIFEST_PATH, MANIFEST_BIN_PATH);
+    assert(manifest_loaded);
+    manifest_define(game, &game->manifest);
+    trace_end();
+
+    game->player_idx = 1;
+    init_player(game, game->player_idx);
+    init_orc(game);
+    for (int column = 0; column < (int)GRID_X; column++)
+    {
+        for (int line = 0; line < (int)GRID_Y; line++)
+        {
+            thing_idx cell = thing_alloc(game);
+            Thing* thing = &game->things[cell];
+            thing->position.x = LINE_NUMBER_OFFSET + CELL_WIDTH*column + CELL_WIDTH/2.0;
+            thing->position.y = CELL_HEIGHT*line + CELL_HEIGHT/2.0;
+            thing->kind = GRID_CELL;
+            int idx = 0;
+            idx = rand() % HIT_TEXT_CAPACITY;
+            thing->hit_text_idx = idx;
+            activity_add(game, cell);
+        }
+    }
+    trace_end();
+}
+
+void emit_table_begin(FILE* file, const char* type, const char* name, const char* dims)
 {
-    Vector2 position = {SCREEN_WIDTH/4.0, STAGE_COORDINATE};
-    thing_idx idx = ++game->thing_num;
-    game->things[idx].position = position;
-    game->things[idx].orientation.x = 1;
-    game->things[idx].orientation.y = 0;
-    game->things[idx].traits = ENEMY_TRAITS_DEFAULT;
-    game->things[idx].kind = KNIGHT;
+    fprintf(file, "static const %s %s%s = {\n", type, name, dims);
 }
 
-Game init_game()
+// loads every kind and writes where load_animations put its animations as
+// const tables, so the lookups of a known kind are an index instead of a search
+bool emit_kind_tables(Game* game, const char* path)
 {
-    Game game = {0};
-    //default texture is useless curently
-    Image default_texture_image = GenImageColor(CELL_WIDTH, CELL_HEIGHT, PURPLE);
-    game.animations[0].textures[0] = LoadTextureFromImage(default_texture_image);
-    assert( game.animations[0].textures[0].width == CELL_WIDTH);
-    game.animations[0].sprite_num = 1;
-    game.animation_num++;
-
-    generate_hit_text(&game);
-
-    game.player_idx = 1;
-    init_player(&game, game.player_idx);
-    init_orc(&game);
-
-    { 
-        SpriteSet set = {0};
-        set.kind = KNIGHT;
-        set.sprites[IDLE_IMAGE].image_path = "assets/Knight_3/Idle.png";
-        set.sprites[ATTACK_IMAGE].image_path = "assets/Knight_3/Attack 2.png";
-        set.sprites[WALK_IMAGE].image_path = "assets/Knight_2/Walk.png";
-        set.sprites[IDLE_IMAGE].frame_num = 4;
-        set.sprites[ATTACK_IMAGE].frame_num = 4;
-        set.sprites[WALK_IMAGE].frame_num = 8;
-        //fix this
-        set.figure_width = 100;
-        set.figure_height = 64;
-        ADD_ANCHORS(set, IDLE_IMAGE, 64, 192, 320, 448);
-        ADD_ANCHORS(set, WALK_IMAGE, 64, 192, 320, 448, 576, 704, 832, 960);
-        ADD_ANCHORS(set, ATTACK_IMAGE, 64, 192, 320, 448);
-        load_animations(&game, set, PLAYER_TRAITS);
-    }
-    {
-        SpriteSet set = {0};
-        set.kind = ORC;
-        set.figure_height = 65;
-        set.sprites[IDLE_IMAGE].image_path = "assets/Craftpix_Orc/Orc_Berserk/Idle.png";
-        set.sprites[ATTACK_IMAGE].image_path = "assets/Craftpix_Orc/Orc_Berserk/Attack_1.png";
-        set.sprites[WALK_IMAGE].image_path = "assets/Craftpix_Orc/Orc_Berserk/Walk.png";
-        set.sprites[HURT_IMAGE].image_path = "assets/Craftpix_Orc/Orc_Berserk/Hurt.png";
-        set.sprites[DEAD_IMAGE].image_path = "assets/Craftpix_Orc/Orc_Berserk/Dead.png";
-        set.sprites[IDLE_IMAGE].frame_num = 5;
-        set.sprites[ATTACK_IMAGE].frame_num = 4;
-        set.sprites[WALK_IMAGE].frame_num = 7;
-        set.sprites[HURT_IMAGE].frame_num = 2;
-        set.sprites[DEAD_IMAGE].frame_num = 4;
-        set.figure_width = 64; 
-
-        ADD_ANCHORS(set, IDLE_IMAGE, 48, 144, 240, 336, 432);
-        ADD_ANCHORS(set, WALK_IMAGE, 48, 144, 240, 336, 432, 528, 624);
-        ADD_ANCHORS(set, ATTACK_IMAGE, 45, 140, 245, 341);
-        ADD_ANCHORS(set, HURT_IMAGE, 48, 144);
-        ADD_ANCHORS(set, DEAD_IMAGE, 48, 144, 240, 336);
-        load_animations(&game, set, PLAYER_TRAITS);
-    }
-    { 
-        SpriteSet set = {0};
-        set.kind = YAMABUSHI;
-        set.figure_height = 100;
-        set.sprites[IDLE_IMAGE].image_path = "assets/Yamabushi/Idle.png";
-        set.sprites[ATTACK_IMAGE].image_path = "assets/Yamabushi/Attack_1.png";
-        set.sprites[WALK_IMAGE].image_path = "assets/Yamabushi/Walk.png";
-        set.sprites[JUMP_IMAGE].image_path = "assets/Yamabushi/Jump.png";
-        set.sprites[HURT_IMAGE].image_path = "assets/Yamabushi/Hurt.png";
-        set.sprites[DEAD_IMAGE].image_path = "assets/Yamabushi/Dead.png";
-        set.sprites[IDLE_IMAGE].frame_num = 6;
-        set.sprites[ATTACK_IMAGE].frame_num = 3;
-        set.sprites[WALK_IMAGE].frame_num = 8;
-        set.sprites[JUMP_IMAGE].frame_num = 15;
-        set.sprites[HURT_IMAGE].frame_num = 3;
-        set.sprites[DEAD_IMAGE].frame_num = 6;
-        set.figure_width = 100; 
-
-        ADD_ANCHORS(set, IDLE_IMAGE, 68, 200, 324, 452, 580, 708);
-        ADD_ANCHORS(set, WALK_IMAGE, 64, 192, 320, 448, 576, 704, 832, 960);
-        ADD_ANCHORS(set, ATTACK_IMAGE, 55, 189, 313);
-        ADD_ANCHORS(set, JUMP_IMAGE, 64, 192, 320, 448, 576, 704, 832, 960, 1088, 1216, 1344, 1472, 1600, 1728, 1856);
-        ADD_ANCHORS(set, HURT_IMAGE, 64, 192, 320);
-        ADD_ANCHORS(set, DEAD_IMAGE, 64, 192, 320, 448, 576, 704);
-        for (size_t i = 0; i < set.sprites[JUMP_IMAGE].frame_num; i++)
-        {
-            set.sprites[JUMP_IMAGE].widths[i] = (int)set.figure_width;
-        }
-        for (size_t i = 0; i < set.sprites[ATTACK_IMAGE].frame_num; i++)
-        {
-            set.sprites[ATTACK_IMAGE].widths[i] = (int)set.figure_width;
-        }
-
-        set.sprites[ATTACK_IMAGE].widths[1] = set.figure_width + 30;
-        load_animations(&game, set, PLAYER_TRAITS);
-    }
-    for(thing_idx i = 1; i <= game.thing_num; i++)
-    {
-        {
-            // calculate reach from attack animation size
-            Thing* thing = &game.things[i];
-            thing->attr = HITTING;
-            thing_idx anim_idx = get_animation_idx(&game, i);
-            Animation* anim = &game.animations[anim_idx];
-            int max_attack_width = 0;
-            for (size_t frame = 0; frame < anim->sprite_num; frame++)
+    Resources* resources = &game->resources;
+    resources_configure(game, 0);
+    size_t max_animations = 1;
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++)
+    {
+        KindResources* res = &resources->kinds[kind];
+        if (!res->defined) continue;
+        if (!res->loaded) resource_load(game, kind);
+        max_animations = MAX(max_animations, res->animation_num);
+    }
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "TABLES: can't write %s: %s", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "// generated by ./nob from %s and the sheets it names, do not edit\n", MANIFEST_PATH);
+    fprintf(file, "#define TABLE_KIND_NUM %zu\n", resources->kind_num);
+    fprintf(file, "#define TABLE_MAX_ANIMATIONS %zu\n\n", max_animations);
+
+    emit_table_begin(file, "char* const", "TABLE_KIND_NAMES", "[TABLE_KIND_NUM]");
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++) fprintf(file, "    \"%s\",\n", kind_name(game, kind));
+    fprintf(file, "};\n");
+    emit_table_begin(file, "uint32_t", "TABLE_ANIMATION_NUM", "[TABLE_KIND_NUM]");
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++) fprintf(file, "    %zu,\n", resources->kinds[kind].animation_num);
+    fprintf(file, "};\n");
+
+    // rows of the kind in load order, flipped ones included
+    const char* row_tables[] = {"TABLE_ANIMATION_ATTR", "TABLE_FRAME_NUM", "TABLE_DURATION_FRAMES"};
+    for (size_t table = 0; table < sizeof(row_tables)/sizeof(row_tables[0]); table++)
+    {
+        emit_table_begin(file, "uint32_t", row_tables[table], "[TABLE_KIND_NUM][TABLE_MAX_ANIMATIONS]");
+        for (ThingKind kind = 0; kind < resources->kind_num; kind++)
+        {
+            KindResources* res = &resources->kinds[kind];
+            fprintf(file, "    {");
+            for (size_t i = 0; i < res->animation_num; i++)
             {
-                Texture2D* attack_texture = &anim->textures[frame];
-                if (attack_texture->id == 0) continue;
-                if ((int)attack_texture->width > max_attack_width) max_attack_width = attack_texture->width;
+                Animation* anim = &game->animations[res->first_animation + i];
+                size_t value = table == 0 ? (size_t)anim->attr : table == 1 ? anim->sprite_num : anim->duration_frames;
+                fprintf(file, "%s%zu", i == 0 ? "" : ", ", value);
             }
-            if (max_attack_width == 0) max_attack_width = anim->textures[0].width;
-            thing->reach = (float)max_attack_width / (float)CELL_WIDTH / 2.0f;
+            if (res->animation_num == 0) fprintf(file, "0");
+            fprintf(file, "}, // %s\n", kind_name(game, kind));
         }
+        fprintf(file, "};\n");
+    }
+
+    // row of the animation a state shows, looking right and left
+    emit_table_begin(file, "uint32_t", "TABLE_ANIMATION_SLOT", "[TABLE_KIND_NUM][STATE_NUM][2]");
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++)
+    {
+        KindResources* res = &resources->kinds[kind];
+        fprintf(file, "    {");
+        for (State state = 0; state < STATE_NUM; state++)
         {
-            // calculate hitbox from idle animation size
-            Thing* thing = &game.things[i];
-            thing->attr = IDLING;
-            thing_idx anim_idx = get_animation_idx(&game, i);
-            Animation* anim = &game.animations[anim_idx];
-            thing->height = (float)(anim->textures[0].height) / (float)(CELL_HEIGHT);
-            thing->width = (float)(anim->textures[0].width) / (float)(CELL_WIDTH);
+            size_t right = 0;
+            size_t left = 0;
+            if (res->defined)
+            {
+                right = get_animation_idx_for(game, kind, state_attributes(state)) - res->first_animation;
+                left = get_animation_idx_for(game, kind, state_attributes(state) | LOOKS_LEFT) - res->first_animation;
+            }
+            fprintf(file, "%s{%zu, %zu}", state == 0 ? "" : ", ", right, left);
         }
+        fprintf(file, "}, // %s\n", kind_name(game, kind));
     }
-    for (int column = 0; column < (int)GRID_X; column++)
+    fprintf(file, "};\n");
+
+    // reach and hitbox as thing_measure gives them, hex floats are exact
+    float reach[MAX_KINDS] = {0};
+    float height[MAX_KINDS] = {0};
+    float width[MAX_KINDS] = {0};
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++)
     {
-        for (int line = 0; line < (int)GRID_Y; line++)
+        if (resources->kinds[kind].defined) kind_measure(game, kind, &reach[kind], &height[kind], &width[kind]);
+    }
+    const char* measure_tables[] = {"TABLE_REACH", "TABLE_HEIGHT", "TABLE_WIDTH"};
+    float* measures[] = {reach, height, width};
+    for (size_t table = 0; table < sizeof(measure_tables)/sizeof(measure_tables[0]); table++)
+    {
+        emit_table_begin(file, "float", measure_tables[table], "[TABLE_KIND_NUM]");
+        for (ThingKind kind = 0; kind < resources->kind_num; kind++)
         {
-            Thing* thing = &game.things[++game.thing_num]; 
-            thing->position.x = LINE_NUMBER_OFFSET + CELL_WIDTH*column + CELL_WIDTH/2.0;
-            thing->position.y = CELL_HEIGHT*line + CELL_HEIGHT/2.0;
-            thing->kind = GRID_CELL;
-            int idx = 0;
-            idx = rand() % HIT_TEXT_CAPACITY;
-            thing->hit_text_idx = idx;
+            fprintf(file, "    %af, // %s\n", measures[table][kind], kind_name(game, kind));
         }
+        fprintf(file, "};\n");
     }
-    return game;
+    bool written = !ferror(file);
+    written = fclose(file) == 0 && written;
+    if (!written) TraceLog(LOG_ERROR, "TABLES: can't write %s", path);
+    else TraceLog(LOG_INFO, "TABLES: wrote %zu kinds to %s", resources->kind_num, path);
+    return written;
 }
 
 void draw_game(Game* game)
@@ -1090,6 +4788,22 @@ void draw_game(Game* game)
     draw_things(game);
 }
 
+// upscale the low resolution render target to the window, keeping aspect ratio
+void present_render_target(RenderTexture2D target)
+{
+    float window_width = GetScreenWidth();
+    float window_height = GetScreenHeight();
+    float scale = MIN(window_width/RENDER_WIDTH, window_height/RENDER_HEIGHT);
+    Rectangle source = {.x = 0, .y = 0, .width = target.texture.width, .height = -target.texture.height};
+    Rectangle dest = {
+        .x = (window_width - RENDER_WIDTH*scale)/2.0f,
+        .y = (window_height - RENDER_HEIGHT*scale)/2.0f,
+        .width = RENDER_WIDTH*scale,
+        .height = RENDER_HEIGHT*scale,
+    };
+    DrawTexturePro(target.texture, source, dest, ZERO_VECTOR, 0.0f, WHITE);
+}
+
 bool is_num_pressed(char key)
 {
     // KEY_ZERO            = 48,       // Key: 0
@@ -1118,6 +4832,8 @@ void process_input(Game* game)
         if ((player->state == IDLE) || (player->state == MOVE))
         {
             state_transition(game, game->player_idx, INPUT);
+            latency_mark(game, LATENCY_CONSUMED);
+            latency_mark(game, LATENCY_STATE);
             if (is_num_pressed(game->key_pressed)) 
             {
                 int key_num = game->key_pressed - 48;
@@ -1129,19 +4845,19 @@ void process_input(Game* game)
     // if (Vector2Equals(player->velocity, ZERO_VECTOR))
     {
 
-        if (IsKeyDown(KEY_L)) 
+        if (game->held_keys & HELD_RIGHT) 
         {
             player->orientation.x = 1;
             player->orientation.y = 0;
             player->velocity.x = 1*3;
         }
-        if (IsKeyDown(KEY_H)) 
+        if (game->held_keys & HELD_LEFT) 
         {
             player->orientation.x = -1;
             player->orientation.y = 0;
             player->velocity.x = -1*3;
         }
-        if (IsKeyDown(KEY_K)) 
+        if (game->held_keys & HELD_UP) 
         {
             // state_transition(game, game->player_idx, TAKE_OFF_JUMP);
             player->orientation.x = 0;
@@ -1173,99 +4889,885 @@ void process_input(Game* game)
 }
 
 
-void npc_ai(Game* game)
+// expensive part of the ai: where is the player and should we walk there
+void npc_think(Game* game, thing_idx i)
 {
-    for(thing_idx i = 0; i < MAX_THINGS; i++)
+    Thing* thing = &game->things[i];
+    Thing* player = &game->things[game->player_idx];
     {
-        Thing* thing = &game->things[i];
-        Thing* player = &game->things[game->player_idx];
-        if ((thing->traits & ENEMY) == ENEMY)
+        Vector2 direction_to_player = {0};
+        direction_to_player.x = player->position.x - thing->position.x;
+        direction_to_player.y = player->position.y - thing->position.y;
+        float len = Vector2Length(direction_to_player);
+        if (len > 0.0001f)
+        {   
+            direction_to_player.x /= len;
+            direction_to_player.y /= len;
+            thing->orientation = direction_to_player;
+            if ((thing->traits & CAN_FLY) != CAN_FLY) thing->orientation.y = 0;
+            thing->orientation = Vector2Normalize(thing->orientation);
+        }
+    }
+    float dist_to_player = 0;
+    if ((thing->traits & CAN_FLY) == CAN_FLY) dist_to_player = Vector2Distance(thing->position, player->position);
+    else dist_to_player = fabs(thing->position.x - player->position.x);
+    thing->ai_move = (dist_to_player > NPC_STOP_DISTANCE) && (dist_to_player <= NPC_AGGRO_DISTANCE);
+    if (thing->ai_move) activity_wake(game, i);
+}
+
+// grid cell of a coordinate, cells are as wide as the separation radius
+int crowd_cell_coord(float v)
+{
+    return (int)floorf(v/CROWD_SEPARATION_RADIUS);
+}
+
+// bucket of a cell, neighbouring cells may share one
+uint32_t crowd_hash(int cx, int cy)
+{
+    return ((uint32_t)cx*73856093u ^ (uint32_t)cy*19349663u) & (CROWD_HASH_SIZE - 1);
+}
+
+void crowd_rebuild(Game* game)
+{
+    Crowd* crowd = &game->crowd;
+    AiScheduler* ai = &game->ai;
+    size_t member_num = ai->npc_num + ai->dormant_num;
+    memset(crowd->cell_start, 0, sizeof(crowd->cell_start));
+    for (size_t member = 0; member < member_num; member++)
+    {
+        Thing* thing = &game->things[ai_member(ai, member)];
+        uint32_t cell = crowd_hash(crowd_cell_coord(thing->position.x), crowd_cell_coord(thing->position.y));
+        crowd->cell_of[member] = cell;
+        crowd->cell_start[cell + 1]++;
+    }
+    for (size_t cell = 0; cell < CROWD_HASH_SIZE; cell++) crowd->cell_start[cell + 1] += crowd->cell_start[cell];
+    // scatter, cell_start[cell] is used as the write cursor and restored below
+    for (size_t member = 0; member < member_num; member++)
+    {
+        thing_idx idx = ai_member(ai, member);
+        uint32_t dst = crowd->cell_start[crowd->cell_of[member]]++;
+        crowd->xs[dst] = game->things[idx].position.x;
+        crowd->ys[dst] = game->things[idx].position.y;
+        crowd->sorted[dst] = idx;
+    }
+    for (size_t cell = CROWD_HASH_SIZE; cell > 0; cell--) crowd->cell_start[cell] = crowd->cell_start[cell - 1];
+    crowd->cell_start[0] = 0;
+    crowd->member_num = member_num;
+}
+
+// sum of pushes away from the members in [start, end). The push grows like
+// 1/d down to an eighth of the radius and fades to zero at the radius;
+// members at the exact same spot are told apart by their sorted position
+Vector2 crowd_accumulate(Crowd* crowd, uint32_t start, uint32_t end, uint32_t self, float px, float py)
+{
+    const float r2 = CROWD_SEPARATION_RADIUS*CROWD_SEPARATION_RADIUS;
+    const float min_d = CROWD_SEPARATION_RADIUS/8.0f;
+    const float min_d2 = min_d*min_d;
+    const float eps = 1e-3f;
+    float sum_x = 0.0f;
+    float sum_y = 0.0f;
+    uint32_t k = start;
+#ifdef __SSE2__
+    __m128 v_px = _mm_set1_ps(px);
+    __m128 v_py = _mm_set1_ps(py);
+    __m128 v_r2 = _mm_set1_ps(r2);
+    __m128 v_inv_r2 = _mm_set1_ps(1.0f/r2);
+    __m128 v_eps = _mm_set1_ps(eps);
+    __m128 v_min_d2 = _mm_set1_ps(min_d2);
+    __m128 v_zero = _mm_setzero_ps();
+    __m128 v_min_d = _mm_set1_ps(min_d);
+    __m128 v_sum_x = v_zero;
+    __m128 v_sum_y = v_zero;
+    for (; k + 4 <= end; k += 4)
+    {
+        __m128 dx = _mm_sub_ps(v_px, _mm_loadu_ps(&crowd->xs[k]));
+        __m128 dy = _mm_sub_ps(v_py, _mm_loadu_ps(&crowd->ys[k]));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        // tie break for stacked members: lower sorted index goes left
+        __m128i lane = _mm_add_epi32(_mm_set1_epi32((int)k), _mm_set_epi32(3, 2, 1, 0));
+        __m128 before_self = _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32((int)self)));
+        __m128 side = _mm_or_ps(_mm_and_ps(before_self, v_min_d), _mm_andnot_ps(before_self, _mm_sub_ps(v_zero, v_min_d)));
+        __m128 stacked = _mm_cmplt_ps(d2, v_eps);
+        dx = _mm_or_ps(_mm_and_ps(stacked, side), _mm_andnot_ps(stacked, dx));
+        d2 = _mm_max_ps(d2, v_min_d2);
+        __m128 falloff = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(v_r2, d2), v_inv_r2), v_zero);
+        __m128 weight = _mm_div_ps(falloff, d2);
+        __m128 is_self = _mm_castsi128_ps(_mm_cmpeq_epi32(lane, _mm_set1_epi32((int)self)));
+        weight = _mm_andnot_ps(is_self, weight);
+        v_sum_x = _mm_add_ps(v_sum_x, _mm_mul_ps(dx, weight));
+        v_sum_y = _mm_add_ps(v_sum_y, _mm_mul_ps(dy, weight));
+    }
+    float lanes_x[4];
+    float lanes_y[4];
+    _mm_storeu_ps(lanes_x, v_sum_x);
+    _mm_storeu_ps(lanes_y, v_sum_y);
+    sum_x = lanes_x[0] + lanes_x[1] + lanes_x[2] + lanes_x[3];
+    sum_y = lanes_y[0] + lanes_y[1] + lanes_y[2] + lanes_y[3];
+#endif //__SSE2__
+    for (; k < end; k++)
+    {
+        if (k == self) continue;
+        float dx = px - crowd->xs[k];
+        float dy = py - crowd->ys[k];
+        float d2 = dx*dx + dy*dy;
+        if (d2 < eps) dx = (k < self) ? min_d : -min_d;
+        d2 = MAX(d2, min_d2);
+        float falloff = MAX((r2 - d2)/r2, 0.0f);
+        sum_x += dx*falloff/d2;
+        sum_y += dy*falloff/d2;
+    }
+    return (Vector2){sum_x, sum_y};
+}
+
+// separation steering: every awake npc looks at the 3x3 cells around it
+void crowd_separation(Game* game)
+{
+    Crowd* crowd = &game->crowd;
+    crowd_rebuild(game);
+    for (uint32_t self = 0; self < crowd->member_num; self++)
+    {
+        thing_idx idx = crowd->sorted[self];
+        crowd->push[idx] = ZERO_VECTOR;
+        if (game->activity.asleep[idx]) continue;
+        float px = crowd->xs[self];
+        float py = crowd->ys[self];
+        int cx = crowd_cell_coord(px);
+        int cy = crowd_cell_coord(py);
+        Vector2 push = ZERO_VECTOR;
+        uint32_t visited[9];
+        size_t visited_num = 0;
+        for (int oy = -1; oy <= 1; oy++)
         {
+            for (int ox = -1; ox <= 1; ox++)
             {
-                Vector2 direction_to_player = {0};
-                direction_to_player.x = player->position.x - thing->position.x;
-                direction_to_player.y = player->position.y - thing->position.y;
-                float len = Vector2Length(direction_to_player);
-                if (len > 0.0001f)
-                {   
-                    direction_to_player.x /= len;
-                    direction_to_player.y /= len;
-                    thing->orientation = direction_to_player;
-                    if ((thing->traits & CAN_FLY) != CAN_FLY) thing->orientation.y = 0;
-                    thing->orientation = Vector2Normalize(thing->orientation);
-                }
-            }
-            float dist_to_player = 0;
-            if ((thing->traits & CAN_FLY) == CAN_FLY) dist_to_player = Vector2Distance(thing->position, player->position);
-            else dist_to_player = fabs(thing->position.x - player->position.x);
-            if (dist_to_player > 64)
-            {
-                thing->velocity = Vector2Scale(thing->orientation, 1.0f);
-            }
-            else
-            {
-                thing->velocity = ZERO_VECTOR;
-            }
-            if (thing->state == DEFEND)
-            {
-                for (int char_idx = 0; char_idx < DEFEND_TEXT_CAPACITY; char_idx++) 
-                {
-                    if(thing->defend_text[char_idx] == 0) continue;
-                    if ((rand() % 100) < thing->accuracy)
-                    // if (100 < thing->accuracy)
-                    {
-                        thing->defend_text[char_idx] = 0;
-                        continue;
-                    }
-                    else {break;}
-                }
-                thing->state_cnt = 10000000; 
+                uint32_t cell = crowd_hash(cx + ox, cy + oy);
+                // hash collisions can map two neighbours to the same bucket
+                bool seen = false;
+                for (size_t v = 0; v < visited_num; v++) seen = seen || (visited[v] == cell);
+                if (seen) continue;
+                visited[visited_num++] = cell;
+                push = Vector2Add(push, crowd_accumulate(crowd, crowd->cell_start[cell], crowd->cell_start[cell + 1], self, px, py));
             }
         }
+        // a single full overlap accumulates 8/radius, scale that to CROWD_SEPARATION_SPEED
+        push = Vector2Scale(push, CROWD_SEPARATION_SPEED*CROWD_SEPARATION_RADIUS/8.0f);
+        if (Vector2Length(push) < CROWD_SEPARATION_DEADZONE) push = ZERO_VECTOR;
+        crowd->push[idx] = push;
+    }
+}
+
+// cheap part of the ai, runs for every awake npc every tick
+void npc_steer(Game* game, thing_idx i)
+{
+    Thing* thing = &game->things[i];
+    if (thing->ai_move)
+    {
+        thing->velocity = Vector2Scale(thing->orientation, 1.0f);
+    }
+    else
+    {
+        thing->velocity = ZERO_VECTOR;
+    }
+    // keep out of the way of other npcs unless busy with something else
+    if ((thing->state == IDLE) || (thing->state == MOVE))
+    {
+        Vector2 push = game->crowd.push[i];
+        // walkers can only be pushed along the stage
+        if ((thing->traits & CAN_FLY) != CAN_FLY) push.y = 0.0f;
+        thing->velocity = Vector2Add(thing->velocity, push);
+    }
+}
+
+// only npcs with a keystroke due this tick are touched
+void npc_typing(Game* game)
+{
+    TypingQueue* queue = &game->typing;
+    while ((queue->event_num > 0) && (queue->events[0].due_tick <= game->tick))
+    {
+        thing_idx i = queue->events[0].idx;
+        typing_cancel(queue, i);
+        Thing* thing = &game->things[i];
+        if (thing->state != DEFEND) continue;
+        size_t ch_idx = get_first_char_idx(thing->defend_text, DEFEND_TEXT_CAPACITY);
+        if (thing->defend_text[ch_idx] == 0)
+        {
+            state_expire(game, i);
+            continue;
+        }
+        if (rand_float()*100.0f >= thing->accuracy)
+        {
+            // a typo ends the defense, the remaining chars are taken as damage
+            state_expire(game, i);
+            continue;
+        }
+        thing->defend_text[ch_idx] = 0;
+        if (get_damage_to_take(thing) == 0) state_expire(game, i);
+        else typing_schedule(queue, i, game->tick + typing_interval_frames(thing));
+    }
+}
+
+void npc_ai(Game* game)
+{
+    AiScheduler* ai = &game->ai;
+    uint64_t start_ns = (ai->budget_ns != 0) ? now_ns() : 0;
+    ai->thinks_last_tick = 0;
+    for (size_t n = 0; n < ai->npc_num; n++)
+    {
+        size_t slot = (ai->cursor + n) % ai->npc_num;
+        Thing* thing = &game->things[ai->npcs[slot]];
+        if (thing->ai_next_think > game->tick) continue;
+        // reading the clock costs about as much as a decision, check it every few thinks
+        if ((ai->budget_ns != 0) && (ai->thinks_last_tick % 8 == 7) && (now_ns() - start_ns >= ai->budget_ns))
+        {
+            // npcs left over stay due and are first in line next tick
+            ai->cursor = slot;
+            break;
+        }
+        npc_think(game, ai->npcs[slot]);
+        thing->ai_next_think = game->tick + ai->think_interval;
+        ai->thinks_last_tick++;
+    }
+    // every dormant npc thinks once per AI_DORMANT_INTERVAL_FACTOR think
+    // intervals, the ones the player comes close to wake up and steer this tick
+    size_t period = ai->think_interval*AI_DORMANT_INTERVAL_FACTOR;
+    size_t slice = (ai->dormant_num + period - 1)/period;
+    for (size_t n = 0; n < slice && ai->dormant_num > 0; n++)
+    {
+        if (ai->dormant_cursor >= ai->dormant_num) ai->dormant_cursor = 0;
+        npc_think(game, ai->dormant[ai->dormant_cursor++]);
+        ai->thinks_last_tick++;
+    }
+    crowd_separation(game);
+    for (size_t slot = 0; slot < ai->npc_num; slot++) npc_steer(game, ai->npcs[slot]);
+    npc_typing(game);
+}
+
+bool input_queue_push(InputQueue* queue, InputEvent event)
+{
+    size_t next = (queue->tail + 1) % INPUT_QUEUE_CAPACITY;
+    if (next == queue->head) return false;
+    queue->events[queue->tail] = event;
+    queue->tail = next;
+    return true;
+}
+
+bool input_queue_pop(InputQueue* queue, InputEvent* event)
+{
+    if (queue->head == queue->tail) return false;
+    *event = queue->events[queue->head];
+    queue->head = (queue->head + 1) % INPUT_QUEUE_CAPACITY;
+    return true;
+}
+
+// move everything raylib collected on the last poll into the game queue
+void sample_input(Game* game)
+{
+    // raylib doesn't expose the OS event time, the poll that delivered the
+    // char is the earliest point we can observe it
+    uint64_t timestamp_ns = now_ns();
+    int ch = 0;
+    while ((ch = GetCharPressed()) > 0)
+    {
+        InputEvent event = {.ch = ch, .timestamp_ns = timestamp_ns};
+        if (!input_queue_push(&game->input_queue, event)) TraceLog(LOG_WARNING, "input queue is full, dropping '%c'", ch);
+    }
+}
+
+uint8_t sample_held_keys(void)
+{
+    uint8_t held = 0;
+    if (IsKeyDown(KEY_L)) held |= HELD_RIGHT;
+    if (IsKeyDown(KEY_H)) held |= HELD_LEFT;
+    if (IsKeyDown(KEY_K)) held |= HELD_UP;
+    return held;
+}
+
+bool replay_record(Replay* replay, const char* path, uint32_t seed)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "wb");
+    if (replay->file == NULL)
+    {
+        TraceLog(LOG_ERROR, "REPLAY: can't write %s: %s", path, strerror(errno));
+        return false;
+    }
+    ReplayHeader header = {.magic = REPLAY_MAGIC, .version = REPLAY_VERSION, .seed = seed, .frame_ms = (uint32_t)MS_PER_FRAME};
+    fwrite(&header, sizeof(header), 1, replay->file);
+    replay->recording = true;
+    return true;
+}
+
+bool replay_play(Replay* replay, const char* path, uint32_t* seed)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "rb");
+    if (replay->file == NULL)
+    {
+        TraceLog(LOG_ERROR, "REPLAY: can't read %s: %s", path, strerror(errno));
+        return false;
+    }
+    ReplayHeader header = {0};
+    if (fread(&header, sizeof(header), 1, replay->file) != 1 || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION)
+    {
+        TraceLog(LOG_ERROR, "REPLAY: %s is not a replay of this version", path);
+        fclose(replay->file);
+        replay->file = NULL;
+        return false;
+    }
+    *seed = header.seed;
+    replay->playing = true;
+    return true;
+}
+
+// feeds the recorded input of the tick to the game or records the live
+// one, false once a replay has run out
+bool replay_frame(Replay* replay, Game* game)
+{
+    ReplayFrame frame = {.ch = (uint8_t)game->key_pressed, .held = game->held_keys};
+    if (replay->playing)
+    {
+        if (fread(&frame, sizeof(frame), 1, replay->file) != 1)
+        {
+            TraceLog(LOG_INFO, "REPLAY: played %zu frames", replay->frames);
+            replay->playing = false;
+            return false;
+        }
+        game->key_pressed = frame.ch;
+        game->held_keys = frame.held;
+    }
+    else if (replay->recording) fwrite(&frame, sizeof(frame), 1, replay->file);
+    replay->frames++;
+    return true;
+}
+
+void replay_close(Replay* replay)
+{
+    if (replay->file == NULL) return;
+    if (replay->recording) TraceLog(LOG_INFO, "REPLAY: recorded %zu frames", replay->frames);
+    fclose(replay->file);
+    replay->file = NULL;
+}
+
+// the player's attributes and state timing between ai and simulation
+void log_player_tick(Game* game)
+{
+    if (!atomic_load_explicit(&event_log.enabled, memory_order_relaxed)) return;
+    Thing* player = &game->things[game->player_idx];
+    Animation* anim = &game->animations[get_animation_idx(game, game->player_idx)];
+    log_event(LOG_EVENT_PLAYER_TICK, game->tick, player->attr, state_age(game, player), anim->duration_frames);
+}
+
+typedef struct
+{
+    uint64_t frame_ns;
+    uint64_t deadline_ns;
+    uint64_t last_wake_ns;
+    bool low_latency;
+    float frame_ms[PACER_STATS_WINDOW];
+    size_t frame_ms_idx;
+    size_t frame_ms_num;
+    size_t missed_deadlines;
+} FramePacer;
+
+typedef struct
+{
+    float mean_ms;
+    float jitter_ms; // standard deviation of the frame time
+    float min_ms;
+    float max_ms;
+} FrameStats;
+
+void pacer_init(FramePacer* pacer, int fps, bool low_latency)
+{
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->frame_ns = NS_PER_SEC/fps;
+    pacer->low_latency = low_latency;
+    pacer->last_wake_ns = now_ns();
+    pacer->deadline_ns = pacer->last_wake_ns + pacer->frame_ns;
+}
+
+// sleep until shortly before the deadline, then spin for the remainder:
+// the sleep keeps the cpu cool, the spin hides the scheduler's wakeup slack
+void pacer_wait(FramePacer* pacer)
+{
+    uint64_t now = now_ns();
+    if (now + PACER_SPIN_MARGIN_NS < pacer->deadline_ns)
+    {
+        uint64_t sleep_ns = pacer->deadline_ns - PACER_SPIN_MARGIN_NS - now;
+        struct timespec ts = {.tv_sec = sleep_ns/NS_PER_SEC, .tv_nsec = sleep_ns%NS_PER_SEC};
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+    }
+    while ((now = now_ns()) < pacer->deadline_ns) {}
+
+    pacer->frame_ms[pacer->frame_ms_idx] = (float)(now - pacer->last_wake_ns)/1e6f;
+    pacer->frame_ms_idx = (pacer->frame_ms_idx + 1) % PACER_STATS_WINDOW;
+    pacer->frame_ms_num = MIN(pacer->frame_ms_num + 1, PACER_STATS_WINDOW);
+    pacer->last_wake_ns = now;
+
+    pacer->deadline_ns += pacer->frame_ns;
+    // don't try to catch up after a long stall, that would burst frames
+    if (pacer->deadline_ns < now)
+    {
+        pacer->missed_deadlines++;
+        pacer->deadline_ns = now + pacer->frame_ns;
+    }
+}
+
+FrameStats pacer_stats(FramePacer* pacer)
+{
+    FrameStats stats = {0};
+    if (pacer->frame_ms_num == 0) return stats;
+    stats.min_ms = pacer->frame_ms[0];
+    stats.max_ms = pacer->frame_ms[0];
+    for (size_t i = 0; i < pacer->frame_ms_num; i++)
+    {
+        stats.mean_ms += pacer->frame_ms[i];
+        stats.min_ms = MIN(stats.min_ms, pacer->frame_ms[i]);
+        stats.max_ms = MAX(stats.max_ms, pacer->frame_ms[i]);
+    }
+    stats.mean_ms /= pacer->frame_ms_num;
+    for (size_t i = 0; i < pacer->frame_ms_num; i++)
+    {
+        float diff = pacer->frame_ms[i] - stats.mean_ms;
+        stats.jitter_ms += diff*diff;
+    }
+    stats.jitter_ms = sqrtf(stats.jitter_ms/pacer->frame_ms_num);
+    return stats;
+}
+
+// median and 99th percentile of the frame times in the window
+void pacer_percentiles(FramePacer* pacer, float* p50, float* p99)
+{
+    float sorted[PACER_STATS_WINDOW];
+    size_t num = pacer->frame_ms_num;
+    *p50 = 0.0f;
+    *p99 = 0.0f;
+    if (num == 0) return;
+    for (size_t i = 0; i < num; i++)
+    {
+        float value = pacer->frame_ms[i];
+        size_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = value;
+    }
+    *p50 = sorted[(num - 1)*50/100];
+    *p99 = sorted[(num - 1)*99/100];
+}
+
+void print_pacer_stats(FramePacer* pacer)
+{
+    FrameStats stats = pacer_stats(pacer);
+    TraceLog(LOG_INFO, "frame time: mean %.3fms jitter %.3fms min %.3fms max %.3fms missed %zu",
+             stats.mean_ms, stats.jitter_ms, stats.min_ms, stats.max_ms, pacer->missed_deadlines);
+}
+
+#ifdef __linux__
+bool live_stats_open(void)
+{
+    snprintf(live.name, sizeof(live.name), "/"LIVE_STATS_PREFIX"%d", (int)getpid());
+    int fd = shm_open(live.name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        TraceLog(LOG_WARNING, "LIVESTATS: can't create %s: %s", live.name, strerror(errno));
+        return false;
     }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(LiveStats)) == 0) map = mmap(NULL, sizeof(LiveStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        TraceLog(LOG_WARNING, "LIVESTATS: can't map %s: %s", live.name, strerror(errno));
+        shm_unlink(live.name);
+        return false;
+    }
+    live.shared = map;
+    live.shared->version = LIVE_STATS_VERSION;
+    live.shared->pid = (int32_t)getpid();
+    // readers skip a segment until its magic is there
+    atomic_thread_fence(memory_order_release);
+    live.shared->magic = LIVE_STATS_MAGIC;
+    TraceLog(LOG_INFO, "LIVESTATS: publishing to /dev/shm%s", live.name);
+    return true;
+}
+
+void live_stats_close(void)
+{
+    if (live.shared == NULL) return;
+    munmap(live.shared, sizeof(LiveStats));
+    shm_unlink(live.name);
+    live.shared = NULL;
+}
+#else
+bool live_stats_open(void)
+{
+    TraceLog(LOG_WARNING, "LIVESTATS: only supported on linux");
+    return false;
+}
+void live_stats_close(void) {}
+#endif //__linux__
+
+// once per frame, everything is gathered before the segment is marked busy.
+// pacer is NULL for headless runs
+void live_stats_publish(Game* game, FramePacer* pacer, uint64_t frame)
+{
+    LiveStats* stats = live.shared;
+    if (stats == NULL) return;
+    float frame_p50_ms = 0.0f;
+    float frame_p99_ms = 0.0f;
+    FrameStats frame_stats = {0};
+    if (pacer != NULL)
+    {
+        pacer_percentiles(pacer, &frame_p50_ms, &frame_p99_ms);
+        frame_stats = pacer_stats(pacer);
+    }
+    LatencyHistogram* presented = &game->latency.stages[LATENCY_PRESENTED];
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    telemetry_totals(&game->telemetry, &hits, &misses);
+    Thing* player = &game->things[game->player_idx];
+
+    live_stats_write_begin(stats);
+    stats->frame = frame;
+    stats->tick = game->tick;
+    stats->frame_p50_ms = frame_p50_ms;
+    stats->frame_p99_ms = frame_p99_ms;
+    stats->frame_max_ms = frame_stats.max_ms;
+    stats->missed_deadlines = pacer != NULL ? (uint32_t)pacer->missed_deadlines : 0;
+    for (TickPhase phase = 0; phase < TICK_PHASE_NUM; phase++) stats->phase_ms[phase] = live.phase_ms[phase];
+    stats->thing_num = (uint32_t)live_thing_num(game);
+    stats->active_num = (uint32_t)game->activity.active_num;
+    stats->npc_num = (uint32_t)(game->ai.npc_num + game->ai.dormant_num);
+    stats->keystroke_p50_ms = latency_percentile_us(presented, 50.0f)/1000.0f;
+    stats->keystroke_p99_ms = latency_percentile_us(presented, 99.0f)/1000.0f;
+    stats->cpm = game->telemetry.cpm;
+    stats->accuracy = hits + misses ? 100.0f*hits/(hits + misses) : 100.0f;
+    stats->player_state = (uint32_t)player->state;
+    stats->player_pending = (uint32_t)get_damage_to_take(player);
+    live_stats_write_end(stats);
+}
+
+// the simulation of a whole replay without drawing, for profiling runs
+void run_headless(Game* game, Replay* replay)
+{
+    uint64_t start_ns = now_ns();
+    while (replay_frame(replay, game))
+    {
+        trace_begin("tick");
+        phase_begin(TICK_PROCESS_INPUT);
+        process_input(game);
+        phase_end(game, TICK_PROCESS_INPUT);
+        phase_begin(TICK_NPC_AI);
+        npc_ai(game);
+        phase_end(game, TICK_NPC_AI);
+        log_player_tick(game);
+        phase_begin(TICK_PROCESS_GAME);
+        process_game(game);
+        phase_end(game, TICK_PROCESS_GAME);
+        phase_begin(TICK_INCREMENT_GAME);
+        increment_game(game);
+        phase_end(game, TICK_INCREMENT_GAME);
+        trace_end();
+        live_stats_publish(game, NULL, replay->frames);
+    }
+    double elapsed_ms = (now_ns() - start_ns)/1e6;
+    TraceLog(LOG_INFO, "REPLAY: %zu ticks in %.1f ms, %.2f us per tick", replay->frames, elapsed_ms, elapsed_ms*1000.0/MAX(replay->frames, (size_t)1));
+}
+
+// anchored to the bottom of the window, below the latency overlay
+void draw_resource_overlay(Game* game)
+{
+    Resources* resources = &game->resources;
+    int font_size = 20;
+    int x = 10;
+    int rows = 1;
+    for (ThingKind kind = 0; kind < resources->kind_num; kind++) rows += resources->kinds[kind].defined;
+    int y = GetScreenHeight() - 10 - rows*(font_size + 4);
+    DrawText(TextFormat("textures %zu KB / budget %zu KB", game->assets.texture_bytes/1024, resources->budget_bytes/1024), x, y, font_size, DARKBLUE);
+    for (ThingKind kind = 0; kind < game->resources.kind_num; kind++)
+    {
+        KindResources* res = &resources->kinds[kind];
+        if (!res->defined) continue;
+        y += font_size + 4;
+        DrawText(TextFormat("%-10s %-8s refs %zu  %zu KB  loads %zu",
+                            kind_name(game, kind),
+                            res->loaded ? "loaded" : "unloaded",
+                            res->refs,
+                            res->texture_bytes/1024,
+                            res->loads),
+                 x, y, font_size, DARKBLUE);
+    }
+}
+
+// drawn in window space on top of the upscaled world so it stays readable
+void draw_latency_overlay(Game* game)
+{
+    LatencyTracker* latency = &game->latency;
+    int font_size = 20;
+    int x = 10;
+    int y = 10;
+    DrawText("keystroke latency (p50 / p99 / max, ms)", x, y, font_size, DARKGREEN);
+    for (size_t stage = 0; stage < LATENCY_STAGE_NUM; stage++)
+    {
+        LatencyHistogram* hist = &latency->stages[stage];
+        y += font_size + 4;
+        DrawText(TextFormat("%-10s %6.2f / %6.2f / %6.2f  n=%llu",
+                            LATENCY_STAGE_NAMES[stage],
+                            latency_percentile_us(hist, 50.0f)/1000.0f,
+                            latency_percentile_us(hist, 99.0f)/1000.0f,
+                            hist->max_us/1000.0f,
+                            (unsigned long long)hist->count),
+                 x, y, font_size, DARKGREEN);
+    }
+    // histogram of the end to end stage, one bar per bucket up to ~65ms
+    LatencyHistogram* presented = &latency->stages[LATENCY_PRESENTED];
+    uint64_t max_count = 1;
+    size_t bar_num = latency_bucket(65536);
+    for (size_t i = 0; i < bar_num; i++) max_count = MAX(max_count, presented->buckets[i]);
+    int bar_height = 60;
+    y += font_size + 4 + bar_height;
+    for (size_t i = 0; i < bar_num; i++)
+    {
+        int height = (int)(bar_height * presented->buckets[i] / max_count);
+        DrawRectangle(x + (int)i*4, y - height, 3, height, DARKGREEN);
+    }
+    Telemetry* telemetry = &game->telemetry;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    telemetry_totals(telemetry, &hits, &misses);
+    y += font_size;
+    DrawText(TextFormat("%.0f cpm (good %d, peak %.0f)  accuracy %.1f%%",
+                        telemetry->cpm, GOOD_CPM, telemetry->peak_cpm,
+                        hits + misses ? 100.0*hits/(hits + misses) : 100.0),
+             x, y, font_size, telemetry->cpm >= GOOD_CPM ? DARKGREEN : MAROON);
+}
+
+// bench.c includes the game without its entry point
+#ifndef NO_MAIN
+static void usage(FILE* stream)
+{
+    fprintf(stream, "Usage: %s [<FLAGS>]\n", flag_program_name());
+    fprintf(stream, "FLAGS:\n");
+    flag_print_options(stream);
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
-    srand(time(0));
+    bool help = false;
+    bool low_latency = false;
+    bool report_pacer_stats = false;
+    char* latency_out = NULL;
+    size_t ai_interval = AI_THINK_INTERVAL_FRAMES;
+    size_t ai_budget_us = AI_BUDGET_US;
+    size_t texture_budget_kb = TEXTURE_BUDGET_KB;
+    bool hot_reload_enabled = false;
+    bool compile_manifest = false;
+    char* enemy = NULL;
+    char* emit_tables = NULL;
+    char* record_path = NULL;
+    char* replay_path = NULL;
+    char* trace_path = NULL;
+    char* event_log_path = NULL;
+    char* telemetry_path = NULL;
+    bool perf_counters = false;
+    bool live_stats_enabled = false;
+    flag_bool_var(&help, "help", false, "Print this help message.");
+    flag_bool_var(&low_latency, "low-latency", false, "Wait for the frame deadline before sampling input instead of after presenting.");
+    flag_bool_var(&report_pacer_stats, "pacer-stats", false, "Periodically log frame time jitter statistics.");
+    flag_str_var(&latency_out, "latency-out", NULL, "Write keystroke latency histograms as csv to this file on exit. F1 toggles the on screen view.");
+    flag_size_var(&ai_interval, "ai-interval", AI_THINK_INTERVAL_FRAMES, "Frames between expensive decisions of one npc.");
+    flag_size_var(&ai_budget_us, "ai-budget-us", AI_BUDGET_US, "Time budget for npc decisions per frame in microseconds, 0 disables it.");
+    flag_size_var(&texture_budget_kb, "texture-budget-kb", TEXTURE_BUDGET_KB, "Texture memory above which unused kinds are evicted, 0 is unlimited. F2 shows the usage.");
+    flag_bool_var(&hot_reload_enabled, "hot-reload", false, "Reload the sprites of a kind when one of its sheets or its entry in "MANIFEST_PATH" changes on disk.");
+    flag_bool_var(&compile_manifest, "compile-manifest", false, "Compile "MANIFEST_PATH" to "MANIFEST_BIN_PATH" and exit.");
+    flag_str_var(&enemy, "enemy", NULL, "Also spawn an enemy of this kind from the sprite manifest, <kind>:<n> picks its nth recolor.");
+    flag_str_var(&emit_tables, "emit-tables", NULL, "Write the animation tables of the manifest kinds as a C header and exit, nob runs it.");
+    flag_str_var(&record_path, "record", NULL, "Record the input of every tick and the random seed to this replay file.");
+    flag_str_var(&replay_path, "replay", NULL, "Play the input of a replay file instead of the keyboard.");
+    flag_bool_var(&headless, "headless", false, "Simulate the -replay without a window as fast as possible and exit.");
+    flag_str_var(&trace_path, "trace", NULL, "Record zones of loading, every tick phase and worker jobs to this file as chrome trace event json, open it in perfetto.");
+    flag_str_var(&event_log_path, "event-log", NULL, "Log the player's attributes every tick and every state transition to this file, formatted by a background thread.");
+    flag_str_var(&telemetry_path, "telemetry", NULL, "Write a binary summary of the session's typing to this file on exit: cpm, accuracy and reaction time histograms per key.");
+    flag_bool_var(&live_stats_enabled, "live-stats", false, "Publish frame times, phase timings, thing counts, keystroke latency and match state every frame in /dev/shm/"LIVE_STATS_PREFIX"<pid> for ./build/livestats.");
+    flag_bool_var(&perf_counters, "perf-counters", false, "Count cycles, instructions, cache and branch misses of every tick phase with perf_event_open and report them on exit.");
+    if (!flag_parse(argc, argv))
+    {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+    if (help)
+    {
+        usage(stdout);
+        return 0;
+    }
+    if (compile_manifest)
+    {
+        static Manifest manifest;
+        if (!manifest_parse_file(&manifest, MANIFEST_PATH)) return 1;
+        if (!manifest_write(&manifest, MANIFEST_BIN_PATH)) return 1;
+        TraceLog(LOG_INFO, "MANIFEST: compiled %zu kinds to %s", manifest.kind_num, MANIFEST_BIN_PATH);
+        return 0;
+    }
+    if (emit_tables != NULL)
+    {
+        static Game game;
+        headless = true;
+        init_game(&game);
+        return emit_kind_tables(&game, emit_tables) ? 0 : 1;
+    }
+
+    if (record_path != NULL && replay_path != NULL)
+    {
+        TraceLog(LOG_ERROR, "REPLAY: -record and -replay can't be used together");
+        return 1;
+    }
+    uint32_t seed = (uint32_t)time(0);
+    static Replay replay;
+    if (replay_path != NULL && !replay_play(&replay, replay_path, &seed)) return 1;
+    if (record_path != NULL && !replay_record(&replay, record_path, seed)) return 1;
+    srand(seed);
+    if (trace_path != NULL && !trace_start(trace_path)) return 1;
+    if (event_log_path != NULL && !log_start(event_log_path)) return 1;
+    // the game is too big for the stack
+    static Game game;
+    if (headless)
+    {
+        if (!replay.playing)
+        {
+            TraceLog(LOG_ERROR, "REPLAY: -headless needs a -replay");
+            return 1;
+        }
+        init_game(&game);
+        if (enemy != NULL) init_enemy_named(&game, enemy);
+        // a time budget would make the run depend on the machine
+        ai_configure(&game, ai_interval, 0);
+        resources_configure(&game, texture_budget_kb);
+        if (perf_counters) perf_start();
+        if (live_stats_enabled) live_stats_open();
+        run_headless(&game, &replay);
+        live_stats_close();
+        perf_report();
+        perf_stop();
+        alloc_report();
+        print_telemetry(&game);
+        if (telemetry_path != NULL) telemetry_write(&game, telemetry_path);
+        replay_close(&replay);
+        log_stop();
+        trace_stop();
+        return 0;
+    }
     int framesCounter = 0;
 
+    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Keyboard Fighter");
-    Game game = init_game();
-    SetTargetFPS(FRAMERATE);               // Set our game to run at 60 frames-per-second
+    RenderTexture2D target = LoadRenderTexture(RENDER_WIDTH, RENDER_HEIGHT);
+    SetTextureFilter(target.texture, TEXTURE_FILTER_POINT);
+    init_game(&game);
+    if (enemy != NULL) init_enemy_named(&game, enemy);
+    ai_configure(&game, ai_interval, ai_budget_us);
+    resources_configure(&game, texture_budget_kb);
+#ifdef __linux__
+    static HotReload hot_reload;
+    if (hot_reload_enabled) hot_reload_start(&hot_reload, &game);
+#else
+    if (hot_reload_enabled) TraceLog(LOG_WARNING, "HOTRELOAD: only supported on linux");
+#endif
+    // pacing is done by the FramePacer, raylib must not wait inside EndDrawing
+    SetTargetFPS(0);
+    FramePacer pacer = {0};
+    pacer_init(&pacer, FRAMERATE, low_latency);
+    if (perf_counters) perf_start();
+    if (live_stats_enabled) live_stats_open();
     //--------------------------------------------------------------------------------------
 
     while (!WindowShouldClose())    // Detect window close button or ESC key
     {
+        trace_begin("frame");
         framesCounter++;
-        BeginDrawing();
+#ifdef __linux__
+        trace_begin("hot_reload_apply");
+        hot_reload_apply(&hot_reload, &game);
+        trace_end();
+#endif
+        if (IsKeyPressed(KEY_F1)) game.latency.show = !game.latency.show;
+        if (IsKeyPressed(KEY_F2)) game.resources.show = !game.resources.show;
+        if (pacer.low_latency)
+        {
+            // present happened right after the previous sim step, so wait now
+            // and sample input as late as possible before simulating
+            trace_begin("pacer_wait");
+            pacer_wait(&pacer);
+            trace_end();
+            PollInputEvents();
+            sample_input(&game);
+        }
+        BeginTextureMode(target);
         ClearBackground(RAYWHITE);
-        int ch = GetCharPressed(); // Get pressed char for text input, using OS mapping
-        // if (ch > 0) TraceLog(LOG_INFO,  "CHAR PRESSED:   %c (%d)", ch, ch);
-        // print_capthing->orientation = tured_text(&game); 
-        game.key_pressed = ch;
+        InputEvent event = {0};
+        game.key_pressed = input_queue_pop(&game.input_queue, &event) ? event.ch : 0;
+        game.held_keys = sample_held_keys();
+        replay_frame(&replay, &game);
+        latency_begin_frame(&game, event.timestamp_ns);
+        // if (game.key_pressed > 0) TraceLog(LOG_INFO,  "CHAR PRESSED:   %c (%d)", game.key_pressed, game.key_pressed);
+        phase_begin(TICK_PROCESS_INPUT);
         process_input(&game);
+        phase_end(&game, TICK_PROCESS_INPUT);
+        phase_begin(TICK_NPC_AI);
         npc_ai(&game);
-#if 0 
-        Thing* player = &game.things[game.player_idx];
-        size_t anim_idx = get_animation_idx(&game, game.player_idx);
-        Animation* anim  = &game.animations[anim_idx];
-        size_t current_state_dur = anim->duration_frames;
-        TraceLog(LOG_INFO,  "Attributes:  (%d) %d %ld", player->attr, player->state_cnt, current_state_dur);
-#endif
+        phase_end(&game, TICK_NPC_AI);
+        log_player_tick(&game);
+        phase_begin(TICK_PROCESS_GAME);
         process_game(&game);
+        phase_end(&game, TICK_PROCESS_GAME);
+        phase_begin(TICK_DRAW_GAME);
         draw_game(&game);
+        phase_end(&game, TICK_DRAW_GAME);
+        phase_begin(TICK_INCREMENT_GAME);
         increment_game(&game);
+        phase_end(&game, TICK_INCREMENT_GAME);
+        EndTextureMode();
+
+        trace_begin("present");
+        BeginDrawing();
+        ClearBackground(BLACK);
+        present_render_target(target);
+        if (game.latency.show) draw_latency_overlay(&game);
+        if (game.resources.show) draw_resource_overlay(&game);
         EndDrawing();
+        trace_end();
+        // stamp what EndDrawing polled now, in both modes, so the pacer wait
+        // below counts towards its latency like the low latency wait does
+        sample_input(&game);
+        // keys nothing consumed, like walking, have no end to end latency
+        if (game.latency.marked[LATENCY_CONSUMED]) latency_mark(&game, LATENCY_PRESENTED);
+        if (!pacer.low_latency)
+        {
+            trace_begin("pacer_wait");
+            pacer_wait(&pacer);
+            trace_end();
+        }
+        if (report_pacer_stats && (framesCounter % PACER_STATS_WINDOW) == 0) print_pacer_stats(&pacer);
+        live_stats_publish(&game, &pacer, framesCounter);
+        trace_end();
     }
-    // for(size_t i = 0; i < game.animation_num; i++)
-    // {
-    //     UnloadTexture(game.animations[i].texture);
-    // }
-    // UnloadTexture(animations[IDLE].texture);
-    // UnloadTexture(animations[HIT].texture);
-    // UnloadTexture(animations[INPUT_MODE].texture);
+    if (report_pacer_stats) print_pacer_stats(&pacer);
+    live_stats_close();
+    perf_report();
+    perf_stop();
+    alloc_report();
+    print_telemetry(&game);
+    if (telemetry_path != NULL) telemetry_write(&game, telemetry_path);
+    if (latency_out != NULL) latency_export(&game.latency, latency_out);
+    replay_close(&replay);
+#ifdef __linux__
+    hot_reload_stop(&hot_reload);
+#endif
+    log_stop();
+    trace_stop();
+    resources_unload_all(&game);
 
+    UnloadRenderTexture(target);
     CloseWindow();                
     return 0;
 }
+#endif //NO_MAIN
@@ -3,8 +3,30 @@
 #define FLAG_IMPLEMENTATION
 #include "flag.h"
 
+#define BUILD_DIR "./build"
+#define MANIFEST_PATH "assets/sprites.manifest"
+#define TABLES_PATH BUILD_DIR"/kind_tables.h"
+#define TABLEGEN_PATH BUILD_DIR"/tablegen"
+#define REPLAYS_DIR "./replays"
+#define PGO_DIR BUILD_DIR"/pgo"
+// gcc names the profile after the object, both pgo builds compile to it
+#define PGO_OBJECT_PATH PGO_DIR"/main.o"
+#define PGO_INSTRUMENTED_PATH PGO_DIR"/main-instrumented"
+#define BENCH_PATH BUILD_DIR"/bench"
+#define BENCH_SCAN_PATH BUILD_DIR"/bench-scan"
+#define LIVESTATS_PATH BUILD_DIR"/livestats"
+#define REPLAYBOT_PATH BUILD_DIR"/replaybot"
+
 Cmd cmd = {0};
 
+typedef struct {
+    bool release;
+    bool native;
+    bool alloc_tracking;
+    // without the generated kind tables, animation lookups scan every row
+    bool scan;
+} Profile;
+
 static void usage(void)
 {
     fprintf(stderr, "Usage: %s [<FLAGS>] [--] [<program args>]\n", flag_program_name());
@@ -12,13 +34,170 @@ static void usage(void)
     flag_print_options(stderr);
 }
 
+static void cc_game(Cmd *cmd, Profile profile)
+{
+    cmd_append(cmd, "cc");
+    cmd_append(cmd, "-Wall");
+    cmd_append(cmd, "-Wextra");
+    cmd_append(cmd, "-fno-strict-overflow");
+    cmd_append(cmd, "-fwrapv");
+    if (profile.release) {
+        cmd_append(cmd, "-O3");
+        cmd_append(cmd, "-flto=auto");
+        if (profile.native) cmd_append(cmd, "-march=native");
+    } else {
+        cmd_append(cmd, "-fsanitize=undefined");
+        cmd_append(cmd, "-ggdb");
+    }
+    if (profile.alloc_tracking) {
+        cmd_append(cmd, "-DALLOC_TRACKING");
+        cmd_append(cmd, "-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free");
+    }
+    cmd_append(cmd, "-I./raylib-5.5_linux_amd64/include/");
+}
+
+static void link_game(Cmd *cmd)
+{
+    cmd_append(cmd, "-L./raylib-5.5_linux_amd64/lib/");
+    cmd_append(cmd, "-l:libraylib.a");
+    cmd_append(cmd, "-lm");
+}
+
+// the manifest and every sheet it names decide the animation layout
+static bool collect_metadata(File_Paths *inputs)
+{
+    static String_Builder manifest = {0};
+    if (!read_entire_file(MANIFEST_PATH, &manifest)) return false;
+    for (size_t i = 0; i < manifest.count; i++) if (manifest.items[i] == '\t') manifest.items[i] = ' ';
+    da_append(inputs, MANIFEST_PATH);
+    String_View text = sb_to_sv(manifest);
+    while (text.count > 0) {
+        String_View line = sv_trim(sv_chop_by_delim(&text, '\n'));
+        String_View key = sv_chop_by_delim(&line, ' ');
+        if (!sv_eq(key, sv_from_cstr("sheet"))) continue;
+        line = sv_trim_left(line);
+        sv_chop_by_delim(&line, ' ');
+        da_append(inputs, temp_sv_to_cstr(sv_trim(line)));
+    }
+    return true;
+}
+
+// a headless run of the game loads every kind and writes the tables, only
+// when the metadata or the game is newer than them
+static bool generate_tables(void)
+{
+    File_Paths inputs = {0};
+    if (!collect_metadata(&inputs)) return false;
+    // and the slicing and measuring code that turns them into the tables
+    da_append(&inputs, "main.c");
+    int rebuild = needs_rebuild(TABLES_PATH, inputs.items, inputs.count);
+    if (rebuild < 0) return false;
+    if (rebuild == 0) return true;
+
+    cc_game(&cmd, (Profile){0});
+    cmd_append(&cmd, "-o", TABLEGEN_PATH, "main.c");
+    link_game(&cmd);
+    if (!cmd_run(&cmd)) return false;
+    cmd_append(&cmd, TABLEGEN_PATH, "-emit-tables", TABLES_PATH);
+    return cmd_run(&cmd);
+}
+
+static bool build_game(Profile profile, const char *source, const char *output)
+{
+    cc_game(&cmd, profile);
+    if (!profile.scan) cmd_append(&cmd, "-DKIND_TABLES");
+    cmd_append(&cmd, "-o", output, source);
+    link_game(&cmd);
+    return cmd_run(&cmd);
+}
+
+// reader of the games' live stats, it doesn't need raylib
+static bool build_livestats(void)
+{
+    const char *inputs[] = {"stats.c", "live_stats.h", "flag.h"};
+    int rebuild = needs_rebuild(LIVESTATS_PATH, inputs, ARRAY_LEN(inputs));
+    if (rebuild < 0) return false;
+    if (rebuild == 0) return true;
+    cmd_append(&cmd, "cc", "-Wall", "-Wextra", "-O2", "-o", LIVESTATS_PATH, "stats.c");
+    return cmd_run(&cmd);
+}
+
+static bool compile_pgo_object(Profile profile, const char *profile_flag)
+{
+    cc_game(&cmd, profile);
+    cmd_append(&cmd, "-DKIND_TABLES");
+    cmd_append(&cmd, profile_flag);
+    cmd_append(&cmd, "-c", "-o", PGO_OBJECT_PATH, "main.c");
+    return cmd_run(&cmd);
+}
+
+static bool link_pgo(Profile profile, const char *profile_flag, const char *output)
+{
+    cc_game(&cmd, profile);
+    cmd_append(&cmd, profile_flag);
+    cmd_append(&cmd, "-o", output, PGO_OBJECT_PATH);
+    link_game(&cmd);
+    return cmd_run(&cmd);
+}
+
+// instrumented build, headless runs of every replay, rebuild with the profile
+static bool build_pgo(Profile profile)
+{
+    if (!mkdir_if_not_exists(PGO_DIR)) return false;
+    // counts of an older build don't match the code anymore
+    File_Paths old = {0};
+    if (!read_entire_dir(PGO_DIR, &old)) return false;
+    for (size_t i = 0; i < old.count; i++) {
+        if (!sv_end_with(sv_from_cstr(old.items[i]), ".gcda")) continue;
+        if (!delete_file(temp_sprintf("%s/%s", PGO_DIR, old.items[i]))) return false;
+    }
+
+    const char *generate = "-fprofile-generate="PGO_DIR;
+    if (!compile_pgo_object(profile, generate)) return false;
+    if (!link_pgo(profile, generate, PGO_INSTRUMENTED_PATH)) return false;
+
+    File_Paths replays = {0};
+    if (!read_entire_dir(REPLAYS_DIR, &replays)) return false;
+    size_t runs = 0;
+    for (size_t i = 0; i < replays.count; i++) {
+        if (!sv_end_with(sv_from_cstr(replays.items[i]), ".kfr")) continue;
+        cmd_append(&cmd, PGO_INSTRUMENTED_PATH, "-headless", "-replay", temp_sprintf("%s/%s", REPLAYS_DIR, replays.items[i]));
+        if (!cmd_run(&cmd)) return false;
+        runs++;
+    }
+    if (runs == 0) {
+        nob_log(ERROR, "no replays in %s to train on", REPLAYS_DIR);
+        return false;
+    }
+
+    const char *use = "-fprofile-use="PGO_DIR;
+    if (!compile_pgo_object(profile, use)) return false;
+    return link_pgo(profile, use, "./main");
+}
+
 int main(int argc, char **argv)
 {
     GO_REBUILD_URSELF(argc, argv);
     bool run = false;
     bool help = false;
+    bool release = false;
+    bool native = false;
+    bool pgo = false;
+    bool bench = false;
+    bool scan = false;
+    bool alloc_tracking = false;
+    bool livestats = false;
+    bool replays = false;
     flag_bool_var(&run, "run", false, "Run the program after compilation.");
     flag_bool_var(&help, "help", false, "Print this help message.");
+    flag_bool_var(&release, "release", false, "Optimized build with -O3 and LTO, without UBSan and debug info.");
+    flag_bool_var(&native, "native", false, "Tune the release build for this machine's CPU.");
+    flag_bool_var(&pgo, "pgo", false, "Release build optimized with profiles of headless runs of the replays in "REPLAYS_DIR".");
+    flag_bool_var(&alloc_tracking, "alloc-tracking", false, "Wrap malloc and free to count allocations per trace zone, ticks assert they don't allocate once the game runs steady.");
+    flag_bool_var(&livestats, "livestats", false, "Run the reader of the live stats of every game on this host with the program args.");
+    flag_bool_var(&replays, "replays", false, "Build the scripted player of replaybot.c and record the replays in "REPLAYS_DIR" again with the program args.");
+    flag_bool_var(&bench, "bench", false, "Build the benchmarks of bench.c with the chosen profile and run them with the program args.");
+    flag_bool_var(&scan, "scan", false, "Build the benchmarks without the generated kind tables, animation lookups scan every row so their -anims padding counts.");
 
     if (!flag_parse(argc, argv)) {
         usage();
@@ -31,23 +210,44 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    cmd_append(&cmd, "cc");
-    cmd_append(&cmd, "-Wall");
-    cmd_append(&cmd, "-Wextra");
-    cmd_append(&cmd, "-fsanitize=undefined");
-    cmd_append(&cmd, "-fno-strict-overflow");
-    cmd_append(&cmd, "-fwrapv");
-    cmd_append(&cmd, "-ggdb");
-    cmd_append(&cmd, "-I./raylib-5.5_linux_amd64/include/");
-    cmd_append(&cmd, "-o", "./main", "main.c");
-    cmd_append(&cmd, "-L./raylib-5.5_linux_amd64/lib/");
-    cmd_append(&cmd, "-l:libraylib.a");
-    cmd_append(&cmd, "-lm");
-    if (!cmd_run(&cmd)) return 1;
+    Profile profile = {
+        .release = release || pgo || native,
+        .native = native,
+        .alloc_tracking = alloc_tracking,
+        .scan = scan && bench,
+    };
+    if (!mkdir_if_not_exists(BUILD_DIR)) return 1;
+    if (!generate_tables()) return 1;
+    if (!build_livestats()) return 1;
+    if (livestats) {
+        cmd_append(&cmd, LIVESTATS_PATH);
+        da_append_many(&cmd, flag_rest_argv(), flag_rest_argc());
+        return cmd_run(&cmd) ? 0 : 1;
+    }
+    if (replays) {
+        // always the debug build, -O3 may contract float math differently and
+        // make the bot play, and record, another game
+        if (!build_game((Profile){0}, "replaybot.c", REPLAYBOT_PATH)) return 1;
+        cmd_append(&cmd, REPLAYBOT_PATH, "-dir", REPLAYS_DIR);
+        da_append_many(&cmd, flag_rest_argv(), flag_rest_argc());
+        return cmd_run(&cmd) ? 0 : 1;
+    }
+    if (bench) {
+        const char *bench_path = scan ? BENCH_SCAN_PATH : BENCH_PATH;
+        if (!build_game(profile, "bench.c", bench_path)) return 1;
+        cmd_append(&cmd, bench_path);
+        da_append_many(&cmd, flag_rest_argv(), flag_rest_argc());
+        return cmd_run(&cmd) ? 0 : 1;
+    }
+    if (pgo) {
+        if (!build_pgo(profile)) return 1;
+    } else {
+        if (!build_game(profile, "main.c", "./main")) return 1;
+    }
 
     if (run) {
         cmd_append(&cmd, "./main");
-        da_append_many(&cmd, argv, argc);
+        da_append_many(&cmd, flag_rest_argv(), flag_rest_argc());
         if (!cmd_run(&cmd)) return 1;
     }
 
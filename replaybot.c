@@ -0,0 +1,179 @@
+// scripted player that records the training replays of replays/, ./nob -replays
+// builds it and records them again. It walks up to the nearest enemy, attacks,
+// types the hit text with some typos and runs the tick of run_headless, so what
+// it records plays back the same with -headless -replay
+#define NO_MAIN
+#include "main.c"
+
+#define BOT_KEY_GAP_FRAMES                          4  // frames between two typed chars, plus up to 4 more
+#define BOT_ATTACK_GAP_FRAMES                       6  // frames between the attack and the first char, plus up to 5 more
+#define BOT_ATTACK_ODDS                             8  // attacks on one of this many idle frames in reach
+#define BOT_WANDER_FRAMES                           90 // walks one of three such spans once no enemy is left
+
+typedef struct
+{
+    const char* name;           // recorded to <dir>/<name>.kfr
+    uint32_t seed;              // of the game's rand and the bot's own
+    size_t frames;
+    size_t chars_per_attack;    // typed before the bot lets the hit text run out
+    uint32_t typo_per_mille;    // chars typed wrong
+    float reach;                // distance to the enemy it attacks from
+    uint32_t pause_frames;      // stands still for half to one and a half of this after a hit, 0 never
+} BotSession;
+
+// what the replays in replays/ were recorded with
+BotSession BOT_SESSIONS[] = {
+    {.name = "typing", .seed = 11, .frames = 2000, .chars_per_attack = 1, .typo_per_mille = 60, .reach = 40},
+    {.name = "duel", .seed = 31, .frames = 1600, .chars_per_attack = 3, .typo_per_mille = 40, .reach = 40, .pause_frames = 150},
+};
+
+// the bot's own xorshift, the game's rand stream stays as it would be live
+static uint64_t bot_state;
+
+uint32_t bot_rand(void)
+{
+    bot_state ^= bot_state << 13;
+    bot_state ^= bot_state >> 7;
+    bot_state ^= bot_state << 17;
+    return (uint32_t)(bot_state >> 32);
+}
+
+// closest enemy that still fights, 0 if none is left
+thing_idx bot_target(Game* game)
+{
+    Thing* player = &game->things[game->player_idx];
+    thing_idx target = 0;
+    float best = INFINITY;
+    for (thing_idx idx = 1; idx <= game->thing_num; idx++)
+    {
+        Thing* thing = &game->things[idx];
+        if (idx == game->player_idx || thing->kind == DEFAULT_THING_KIND) continue;
+        if ((thing->traits & ENEMY) != ENEMY || thing->state == DEATH) continue;
+        float distance = fabsf(thing->position.x - player->position.x);
+        if (distance < best)
+        {
+            best = distance;
+            target = idx;
+        }
+    }
+    return target;
+}
+
+bool bot_record(BotSession session, const char* dir)
+{
+    const char* path = TextFormat("%s/%s.kfr", dir, session.name);
+    static Game game;
+    static Replay replay;
+    if (!replay_record(&replay, path, session.seed)) return false;
+    bot_state = 0x9e3779b97f4a7c15ull ^ session.seed;
+    srand(session.seed);
+    // every session starts from a fresh game, like a run of ./main does
+    memset(&game, 0, sizeof(game));
+    init_game(&game);
+    ai_configure(&game, AI_THINK_INTERVAL_FRAMES, 0);
+    resources_configure(&game, TEXTURE_BUDGET_KB);
+    size_t typed = 0;
+    size_t next_key = 0;
+    size_t pause_until = 0;
+    State last_state = IDLE;
+    for (size_t frame = 0; frame < session.frames; frame++)
+    {
+        Thing* player = &game.things[game.player_idx];
+        thing_idx target = bot_target(&game);
+        game.key_pressed = 0;
+        game.held_keys = 0;
+        if (player->state == INPUT)
+        {
+            if (frame >= next_key && typed < session.chars_per_attack)
+            {
+                char want = game.hit_text[player->hit_text_idx];
+                game.key_pressed = want;
+                if (bot_rand() % 1000 < session.typo_per_mille)
+                {
+                    // any other char of the charset
+                    size_t wrong = (strchr(CHARSET, want) - CHARSET) + 1 + bot_rand() % (CHARSET_SIZE - 1);
+                    game.key_pressed = CHARSET[wrong % CHARSET_SIZE];
+                }
+                next_key = frame + BOT_KEY_GAP_FRAMES + bot_rand() % 5;
+                typed++;
+            }
+        }
+        else if (target != 0 && frame < pause_until)
+        {
+            // catching its breath after a hit
+        }
+        else if (target != 0 && (player->state == IDLE || player->state == MOVE))
+        {
+            float dx = game.things[target].position.x - player->position.x;
+            bool facing = (dx >= 0) == (player->orientation.x >= 0);
+            if (fabsf(dx) > session.reach || !facing) game.held_keys = dx > 0 ? HELD_RIGHT : HELD_LEFT;
+            else if (Vector2Equals(player->velocity, ZERO_VECTOR) && player->state == IDLE && bot_rand() % BOT_ATTACK_ODDS == 0)
+            {
+                game.key_pressed = 'i';
+                typed = 0;
+                next_key = frame + BOT_ATTACK_GAP_FRAMES + bot_rand() % 6;
+            }
+        }
+        else if (target == 0 && (frame/BOT_WANDER_FRAMES) % 3 == 0)
+        {
+            game.held_keys = (frame/(3*BOT_WANDER_FRAMES)) % 2 ? HELD_LEFT : HELD_RIGHT;
+        }
+        if (last_state == HIT && player->state != HIT && session.pause_frames > 0)
+        {
+            pause_until = frame + session.pause_frames/2 + bot_rand() % session.pause_frames;
+        }
+        last_state = player->state;
+        replay_frame(&replay, &game);
+        process_input(&game);
+        npc_ai(&game);
+        process_game(&game);
+        increment_game(&game);
+    }
+    replay_close(&replay);
+    TraceLog(LOG_INFO, "BOT: recorded %s", path);
+    print_telemetry(&game);
+    resources_unload_all(&game);
+    return true;
+}
+
+static void usage(FILE* stream)
+{
+    fprintf(stream, "Usage: %s [<FLAGS>]\n", flag_program_name());
+    fprintf(stream, "FLAGS:\n");
+    flag_print_options(stream);
+}
+
+int main(int argc, char** argv)
+{
+    bool help = false;
+    char* dir = "replays";
+    char* session_name = NULL;
+    flag_bool_var(&help, "help", false, "Print this help message.");
+    flag_str_var(&dir, "dir", dir, "Directory the replays are recorded to.");
+    flag_str_var(&session_name, "session", NULL, "Only record the session of this name, typing or duel.");
+    if (!flag_parse(argc, argv))
+    {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+    if (help)
+    {
+        usage(stdout);
+        return 0;
+    }
+    headless = true;
+    size_t recorded = 0;
+    for (size_t i = 0; i < sizeof(BOT_SESSIONS)/sizeof(BOT_SESSIONS[0]); i++)
+    {
+        if (session_name != NULL && strcmp(session_name, BOT_SESSIONS[i].name) != 0) continue;
+        if (!bot_record(BOT_SESSIONS[i], dir)) return 1;
+        recorded++;
+    }
+    if (recorded == 0)
+    {
+        TraceLog(LOG_ERROR, "BOT: no session named %s", session_name);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+// reads the live stats every game on the host publishes with -live-stats,
+// one row per instance and one row aggregating them
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define FLAG_IMPLEMENTATION
+#include "flag.h"
+#include "live_stats.h"
+
+#define SHM_DIR "/dev/shm"
+
+typedef struct
+{
+    size_t instances;
+    size_t stale;
+    size_t busy;
+    double frame_p50_ms; // summed, averaged when printed
+    float frame_p99_ms;  // worst
+    float frame_max_ms;  // worst
+    uint64_t missed_deadlines;
+    double phase_ms[LIVE_STATS_PHASES];
+    uint64_t thing_num;
+    uint64_t active_num;
+    uint64_t npc_num;
+    float keystroke_p99_ms; // worst
+    double cpm;
+    double accuracy;
+} Aggregate;
+
+static void usage(FILE* stream)
+{
+    fprintf(stream, "Usage: %s [<FLAGS>]\n", flag_program_name());
+    fprintf(stream, "FLAGS:\n");
+    flag_print_options(stream);
+}
+
+static const char* state_name(uint32_t state)
+{
+    return state < LIVE_STATS_STATES ? STATE_NAMES[state] : "?";
+}
+
+// the phase columns are as wide as their names
+static int phase_width(int phase)
+{
+    return (int)strlen(TICK_PHASE_NAMES[phase]);
+}
+
+static void print_header(void)
+{
+    printf("%8s %8s %7s %7s %7s %6s |", "pid", "frame", "p50ms", "p99ms", "maxms", "missed");
+    for (int i = 0; i < LIVE_STATS_PHASES; i++) printf(" %*s", phase_width(i), TICK_PHASE_NAMES[i]);
+    printf(" | %6s %6s %5s | %7s %7s | %5s %6s | %s\n", "things", "active", "npcs", "key p50", "key p99", "cpm", "acc%", "player");
+}
+
+static void print_instance(const LiveStats* stats)
+{
+    printf("%8d %8llu %7.2f %7.2f %7.2f %6u |", stats->pid, (unsigned long long)stats->frame,
+           stats->frame_p50_ms, stats->frame_p99_ms, stats->frame_max_ms, stats->missed_deadlines);
+    for (int i = 0; i < LIVE_STATS_PHASES; i++) printf(" %*.3f", phase_width(i), stats->phase_ms[i]);
+    printf(" | %6u %6u %5u | %7.2f %7.2f | %5.0f %6.1f | %s",
+           stats->thing_num, stats->active_num, stats->npc_num,
+           stats->keystroke_p50_ms, stats->keystroke_p99_ms, stats->cpm, stats->accuracy, state_name(stats->player_state));
+    if (stats->player_pending > 0) printf(" (%u to defend)", stats->player_pending);
+    printf("\n");
+}
+
+static void aggregate_add(Aggregate* all, const LiveStats* stats)
+{
+    all->instances++;
+    all->frame_p50_ms += stats->frame_p50_ms;
+    if (stats->frame_p99_ms > all->frame_p99_ms) all->frame_p99_ms = stats->frame_p99_ms;
+    if (stats->frame_max_ms > all->frame_max_ms) all->frame_max_ms = stats->frame_max_ms;
+    all->missed_deadlines += stats->missed_deadlines;
+    for (int i = 0; i < LIVE_STATS_PHASES; i++) all->phase_ms[i] += stats->phase_ms[i];
+    all->thing_num += stats->thing_num;
+    all->active_num += stats->active_num;
+    all->npc_num += stats->npc_num;
+    if (stats->keystroke_p99_ms > all->keystroke_p99_ms) all->keystroke_p99_ms = stats->keystroke_p99_ms;
+    all->cpm += stats->cpm;
+    all->accuracy += stats->accuracy;
+}
+
+// means of the averaged columns, worst of the percentiles, sums of the counts
+static void print_aggregate(const Aggregate* all)
+{
+    printf("%zu instances", all->instances);
+    if (all->stale > 0) printf(", %zu stale segments", all->stale);
+    if (all->busy > 0) printf(", %zu busy", all->busy);
+    printf("\n");
+    if (all->instances == 0) return;
+    double n = (double)all->instances;
+    printf("%8s %8s %7.2f %7.2f %7.2f %6llu |", "all", "", all->frame_p50_ms/n, all->frame_p99_ms, all->frame_max_ms,
+           (unsigned long long)all->missed_deadlines);
+    for (int i = 0; i < LIVE_STATS_PHASES; i++) printf(" %*.3f", phase_width(i), all->phase_ms[i]/n);
+    printf(" | %6llu %6llu %5llu | %7s %7.2f | %5.0f %6.1f |\n",
+           (unsigned long long)all->thing_num, (unsigned long long)all->active_num, (unsigned long long)all->npc_num,
+           "", all->keystroke_p99_ms, all->cpm/n, all->accuracy/n);
+}
+
+// false if the segment isn't one of a live game
+static bool read_segment(const char* name, LiveStats* stats, Aggregate* all, bool clean)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "/%s", name);
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) return false;
+    // a game between creating and sizing its segment, or a file that isn't
+    // one, would fault on the first read past its end
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LiveStats))
+    {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, sizeof(LiveStats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    const LiveStats* shared = map;
+    bool ok = false;
+    if (shared->magic == LIVE_STATS_MAGIC && shared->version == LIVE_STATS_VERSION)
+    {
+        // a game that crashed leaves its segment behind
+        if (kill(shared->pid, 0) != 0 && errno == ESRCH)
+        {
+            all->stale++;
+            if (clean) shm_unlink(path);
+        }
+        else if (!live_stats_read(shared, stats)) all->busy++;
+        else ok = true;
+    }
+    munmap(map, sizeof(LiveStats));
+    return ok;
+}
+
+static bool print_all(bool clean)
+{
+    DIR* dir = opendir(SHM_DIR);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "ERROR: could not open %s: %s\n", SHM_DIR, strerror(errno));
+        return false;
+    }
+    Aggregate all = {0};
+    print_header();
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, LIVE_STATS_PREFIX, strlen(LIVE_STATS_PREFIX)) != 0) continue;
+        LiveStats stats;
+        if (!read_segment(entry->d_name, &stats, &all, clean)) continue;
+        print_instance(&stats);
+        aggregate_add(&all, &stats);
+    }
+    closedir(dir);
+    print_aggregate(&all);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool help = false;
+    bool clean = false;
+    size_t watch_ms = 0;
+    flag_bool_var(&help, "help", false, "Print this help message.");
+    flag_bool_var(&clean, "clean", false, "Remove the segments of games that are gone.");
+    flag_size_var(&watch_ms, "watch", 0, "Print again every this many milliseconds, 0 prints once.");
+    if (!flag_parse(argc, argv))
+    {
+        usage(stderr);
+        flag_print_error(stderr);
+        return 1;
+    }
+    if (help)
+    {
+        usage(stdout);
+        return 0;
+    }
+    if (watch_ms == 0) return print_all(clean) ? 0 : 1;
+    for (;;)
+    {
+        printf("\033[H\033[2J");
+        if (!print_all(clean)) return 1;
+        fflush(stdout);
+        struct timespec ts = {.tv_sec = watch_ms/1000, .tv_nsec = (long)(watch_ms%1000)*1000000};
+        nanosleep(&ts, NULL);
+    }
+}